@@ -0,0 +1,460 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - double buffered ANSI renderer
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <curses.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+
+#include "ansi.h"
+
+// A cursor jump costs about this many bytes, so shorter stretches of
+// unchanged cells inside a changed span are cheaper to just resend.
+#define ANSI_JUMP_COST 6
+
+// Runs of at least this many blanks are erased with ECH and skipped
+// over with CUF instead of being sent as spaces.
+#define ANSI_BLANK_RUN 12
+
+static int lines;
+static int cols;
+static char *front;
+static char *back;
+static char *output;
+static size_t outputSize;
+static size_t outputLength;
+static int cursorY;
+static int cursorX;
+static int terminalY;
+static int terminalX;
+static struct termios savedTermios;
+static unsigned char input[64];
+static int inputStart;
+static int inputEnd;
+
+static void Emit(const char *data, size_t length)
+{
+	// Append to the frame being built. The buffer is sized for the
+	// worst case, so this only guards against a logic error.
+	if (outputLength + length <= outputSize)
+	{
+		memcpy(output + outputLength, data, length);
+		outputLength += length;
+	}
+}
+
+static void EmitFormat(const char *format, int a, int b)
+{
+	char sequence[32];
+	int length = snprintf(sequence, sizeof(sequence), format, a, b);
+
+	Emit(sequence, length);
+}
+
+static void WriteAll(const char *data, size_t length)
+{
+	// Normally a single write(). Only loop if the terminal took part of it.
+	while (length > 0)
+	{
+		ssize_t written = write(STDOUT_FILENO, data, length);
+
+		if (written <= 0)
+		{
+			return;
+		}
+
+		data += written;
+		length -= written;
+	}
+}
+
+static void MoveTo(int y, int x)
+{
+	// Move the terminal cursor, using the shortest sequence that works.
+	if (terminalY == y && terminalX == x)
+	{
+		return;
+	}
+
+	if (terminalY == y && terminalX >= 0 && x > terminalX)
+	{
+		EmitFormat("\x1b[%dC", x - terminalX, 0);
+	}
+	else
+	{
+		EmitFormat("\x1b[%d;%dH", y + 1, x + 1);
+	}
+
+	terminalY = y;
+	terminalX = x;
+}
+
+static void EmitSpan(const char *cells, int length)
+{
+	// Send a span of cells, collapsing long runs of blanks.
+	int i = 0;
+
+	while (i < length)
+	{
+		int run = 1;
+
+		while (cells[i] == ' ' && i + run < length && cells[i + run] == ' ')
+		{
+			run++;
+		}
+
+		if (cells[i] == ' ' && run >= ANSI_BLANK_RUN)
+		{
+			EmitFormat("\x1b[%dX\x1b[%dC", run, run);
+			i += run;
+		}
+		else
+		{
+			Emit(cells + i, 1);
+			i++;
+		}
+	}
+}
+
+bool AnsiInit()
+{
+	struct winsize size;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) == 0 && size.ws_row > 0 && size.ws_col > 0)
+	{
+		lines = size.ws_row;
+		cols = size.ws_col;
+	}
+	else
+	{
+		lines = 24;
+		cols = 80;
+	}
+
+	// Read keys one at a time without echo, like ncurses cbreak() and noecho().
+	if (tcgetattr(STDIN_FILENO, &savedTermios) != 0)
+	{
+		return false;
+	}
+
+	struct termios raw = savedTermios;
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+
+	front = malloc(lines * cols);
+	back = malloc(lines * cols);
+
+	// Worst case, every cell needs its own cursor jump.
+	outputSize = (size_t) lines * cols * 12 + 64;
+	output = malloc(outputSize);
+
+	if (front == NULL || back == NULL || output == NULL)
+	{
+		return false;
+	}
+
+	memset(front, ' ', lines * cols);
+	memset(back, ' ', lines * cols);
+
+	// Switch to the alternate screen and start from a blank one.
+	const char *start = "\x1b[?1049h\x1b[H\x1b[2J";
+	WriteAll(start, strlen(start));
+
+	terminalY = 0;
+	terminalX = 0;
+
+	return true;
+}
+
+void AnsiShutdown()
+{
+	const char *end = "\x1b[?1049l";
+	WriteAll(end, strlen(end));
+
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &savedTermios);
+
+	free(front);
+	free(back);
+	free(output);
+}
+
+int AnsiLines()
+{
+	return lines;
+}
+
+int AnsiCols()
+{
+	return cols;
+}
+
+void AnsiClear(int top, int rows)
+{
+	// Blank out a band of rows in the back buffer.
+	if (top + rows > lines)
+	{
+		rows = lines - top;
+	}
+
+	if (rows > 0)
+	{
+		memset(back + top * cols, ' ', rows * cols);
+	}
+}
+
+void AnsiPrint(int y, int x, const char *text)
+{
+	// Write text into the back buffer, clipped to the screen.
+	// Tabs advance to the next multiple of 8 like they do in ncurses.
+	if (y < 0 || y >= lines)
+	{
+		return;
+	}
+
+	char *row = back + y * cols;
+
+	for (; *text != '\0' && x < cols; text++)
+	{
+		if (*text == '\t')
+		{
+			int stop = (x / 8 + 1) * 8;
+
+			while (x < stop && x < cols)
+			{
+				if (x >= 0)
+				{
+					row[x] = ' ';
+				}
+
+				x++;
+			}
+		}
+		else
+		{
+			if (x >= 0)
+			{
+				row[x] = *text;
+			}
+
+			x++;
+		}
+	}
+
+	// Like ncurses, leave the cursor just after the text.
+	cursorY = y;
+	cursorX = x < cols ? x : cols - 1;
+}
+
+void AnsiMoveCursor(int y, int x)
+{
+	cursorY = y;
+	cursorX = x;
+}
+
+long long AnsiFlush()
+{
+	// Diff the back buffer against the front buffer, build the escape
+	// sequences for whatever changed, and send the lot in one write().
+	// Returns the number of bytes sent.
+	outputLength = 0;
+
+	for (int y = 0; y < lines; y++)
+	{
+		char *frontRow = front + y * cols;
+		char *backRow = back + y * cols;
+		int x = 0;
+
+		while (x < cols)
+		{
+			if (frontRow[x] == backRow[x])
+			{
+				x++;
+				continue;
+			}
+
+			// Grow the span until there's a gap of unchanged cells
+			// long enough to be worth jumping over.
+			int last = x;
+
+			for (int end = x + 1; end < cols && end - last <= ANSI_JUMP_COST; end++)
+			{
+				if (frontRow[end] != backRow[end])
+				{
+					last = end;
+				}
+			}
+
+			int length = last - x + 1;
+
+			MoveTo(y, x);
+			EmitSpan(backRow + x, length);
+			memcpy(frontRow + x, backRow + x, length);
+
+			// Terminals handle writing the last column differently,
+			// so forget where the cursor is rather than guess.
+			terminalX = last + 1 < cols ? last + 1 : -1;
+			x = last + 1;
+		}
+	}
+
+	MoveTo(cursorY, cursorX);
+
+	if (outputLength > 0)
+	{
+		WriteAll(output, outputLength);
+	}
+
+	return outputLength;
+}
+
+static bool FillInput(int timeoutMillis)
+{
+	// Wait up to timeoutMillis (forever if negative) for more
+	// input, and add whatever arrived to the input buffer.
+	if (inputStart == inputEnd)
+	{
+		inputStart = 0;
+		inputEnd = 0;
+	}
+	else if (inputStart > 0)
+	{
+		memmove(input, input + inputStart, inputEnd - inputStart);
+		inputEnd -= inputStart;
+		inputStart = 0;
+	}
+
+	struct pollfd keyboard = { STDIN_FILENO, POLLIN, 0 };
+
+	if (inputEnd == sizeof(input) || poll(&keyboard, 1, timeoutMillis) <= 0)
+	{
+		return false;
+	}
+
+	ssize_t count = read(STDIN_FILENO, input + inputEnd, sizeof(input) - inputEnd);
+
+	if (count <= 0)
+	{
+		return false;
+	}
+
+	inputEnd += count;
+	return true;
+}
+
+int AnsiGetKey(int timeoutMillis)
+{
+	if (inputStart == inputEnd && !FillInput(timeoutMillis))
+	{
+		return ERR;
+	}
+
+	int key = input[inputStart++];
+
+	if (key == 27)
+	{
+		// Give the rest of an escape sequence a moment to arrive,
+		// then translate the arrow keys.
+		if (inputEnd - inputStart < 2)
+		{
+			FillInput(25);
+		}
+
+		if (inputEnd - inputStart >= 2 && (input[inputStart] == '[' || input[inputStart] == 'O'))
+		{
+			int arrow = ERR;
+
+			switch (input[inputStart + 1])
+			{
+				case 'A':
+					arrow = KEY_UP;
+					break;
+
+				case 'B':
+					arrow = KEY_DOWN;
+					break;
+
+				case 'C':
+					arrow = KEY_RIGHT;
+					break;
+
+				case 'D':
+					arrow = KEY_LEFT;
+					break;
+			}
+
+			if (arrow != ERR)
+			{
+				inputStart += 2;
+				return arrow;
+			}
+		}
+	}
+
+	return key;
+}
+
+long long AnsiGetLine(char *buffer, int size)
+{
+	// Show the prompt, then read a line with the terminal's own
+	// echo and line editing turned back on.
+	long long written = AnsiFlush();
+	int length = 0;
+	bool ended = false;
+	char c;
+
+	// Keys typed before the prompt are already in the input buffer,
+	// unechoed, so take them first and echo them now.
+	while (inputStart < inputEnd && !ended)
+	{
+		c = input[inputStart++];
+
+		if (c == '\r' || c == '\n')
+		{
+			ended = true;
+		}
+		else if ((c == 0x7f || c == '\b') && length > 0)
+		{
+			length--;
+			WriteAll("\b \b", 3);
+			written += 3;
+		}
+		else if (c >= ' ' && c < 0x7f && length < size - 1)
+		{
+			buffer[length++] = c;
+			WriteAll(&c, 1);
+			written++;
+		}
+	}
+
+	struct termios raw;
+	tcgetattr(STDIN_FILENO, &raw);
+	tcsetattr(STDIN_FILENO, TCSANOW, &savedTermios);
+
+	while (!ended && read(STDIN_FILENO, &c, 1) == 1 && c != '\n')
+	{
+		if (length < size - 1)
+		{
+			buffer[length++] = c;
+		}
+	}
+
+	buffer[length] = '\0';
+
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+	// The echoed text isn't in the front buffer, so
+	// resend everything on the next flush.
+	memset(front, '\0', lines * cols);
+	terminalY = -1;
+	terminalX = -1;
+
+	return written;
+}
@@ -0,0 +1,32 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - double buffered ANSI renderer
+
+#ifndef ANSI_H
+#define ANSI_H
+
+#include <stdbool.h>
+
+// A renderer that skips ncurses entirely. Drawing goes into a back
+// buffer of screen cells, and AnsiFlush() sends only the cells that
+// differ from what is already on the terminal, as one write().
+
+bool AnsiInit();
+void AnsiShutdown();
+int AnsiLines();
+int AnsiCols();
+
+void AnsiClear(int top, int rows);
+void AnsiPrint(int y, int x, const char *text);
+void AnsiMoveCursor(int y, int x);
+long long AnsiFlush();
+
+// Keyboard input in the same shape as ncurses getch(), returning
+// ERR on timeout and KEY_UP etc. for the arrow keys.
+int AnsiGetKey(int timeoutMillis);
+// Read a line with echo on, starting with any keys already typed.
+// Returns the number of bytes sent to the terminal.
+long long AnsiGetLine(char *buffer, int size);
+
+#endif
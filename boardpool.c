@@ -0,0 +1,90 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - board memory pool
+
+#include <stdlib.h>
+
+#include "boardpool.h"
+
+static int SizeClass(int tiles)
+{
+	// The smallest power of two that holds tiles.
+	int sizeClass = 0;
+
+	while ((1 << sizeClass) < tiles)
+	{
+		sizeClass++;
+	}
+
+	return sizeClass;
+}
+
+struct BoardMemory *BoardPoolTake(struct BoardPool *pool, int tiles)
+{
+	int sizeClass = SizeClass(tiles);
+
+	if (sizeClass >= BOARD_POOL_CLASSES)
+	{
+		return NULL;
+	}
+
+	pool->takes++;
+
+	struct BoardMemory *memory = pool->free[sizeClass];
+
+	if (memory != NULL)
+	{
+		pool->free[sizeClass] = memory->next;
+		pool->recycled++;
+		return memory;
+	}
+
+	// The arrays follow the header in the same block. The tiles come
+	// first since they need the most alignment after it.
+	int capacity = 1 << sizeClass;
+
+	memory = malloc(sizeof(*memory) + (size_t) capacity * (sizeof(struct Tile) + 3 * sizeof(int)));
+
+	if (memory == NULL)
+	{
+		return NULL;
+	}
+
+	pool->allocations++;
+
+	memory->sizeClass = sizeClass;
+	memory->capacity = capacity;
+	memory->tiles = (struct Tile *) (memory + 1);
+	memory->work = (int *) (memory->tiles + capacity);
+	memory->changes = memory->work + capacity;
+	memory->touched = memory->changes + capacity;
+
+	return memory;
+}
+
+void BoardPoolGive(struct BoardPool *pool, struct BoardMemory *memory)
+{
+	if (memory == NULL)
+	{
+		return;
+	}
+
+	memory->next = pool->free[memory->sizeClass];
+	pool->free[memory->sizeClass] = memory;
+}
+
+void BoardPoolEmpty(struct BoardPool *pool)
+{
+	for (int i = 0; i < BOARD_POOL_CLASSES; i++)
+	{
+		while (pool->free[i] != NULL)
+		{
+			struct BoardMemory *memory = pool->free[i];
+
+			pool->free[i] = memory->next;
+			free(memory);
+			pool->frees++;
+		}
+	}
+}
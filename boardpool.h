@@ -0,0 +1,47 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - board memory pool
+
+#ifndef BOARDPOOL_H
+#define BOARDPOOL_H
+
+#include "minefield.h"
+
+// Everything a Minefield is played in (its tiles, its work stack, the
+// list of tiles a move changed and the list of tiles the board has
+// touched) comes in one block from a pool.
+// Blocks are sized in classes of powers of two tiles, and a block given
+// back is kept on its class's free list for the next board that fits,
+// so dealing board after board of the same size never touches the heap
+// once the pool has warmed up. A pool belongs to one thread.
+
+#define BOARD_POOL_CLASSES 32
+
+struct BoardMemory {
+	struct BoardMemory *next;
+	int sizeClass;
+	int capacity;
+	struct Tile *tiles;
+	int *work;
+	int *changes;
+	int *touched;
+};
+
+// allocations and frees count trips to the heap; takes counts every
+// block handed out, and recycled the ones that came off a free list.
+struct BoardPool {
+	struct BoardMemory *free[BOARD_POOL_CLASSES];
+	long long allocations;
+	long long frees;
+	long long takes;
+	long long recycled;
+};
+
+// A block with room for at least tiles tiles, or NULL if the heap is out.
+struct BoardMemory *BoardPoolTake(struct BoardPool *pool, int tiles);
+void BoardPoolGive(struct BoardPool *pool, struct BoardMemory *memory);
+// Hand every free block back to the heap.
+void BoardPoolEmpty(struct BoardPool *pool);
+
+#endif
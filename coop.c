@@ -0,0 +1,428 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - cooperative play on one huge board
+
+#include <stdio.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "coop.h"
+#include "stats.h"
+
+#define COOP_MAX_PLAYERS 64
+#define COOP_SEED 2024
+// The same share of mines as a normal game, 15 in 100.
+#define COOP_MINE_PERCENT 15
+
+// One benchmark player, who visits their own share of the tiles. Each
+// is on cache lines of its own, since their counts change every move.
+struct CoopWorker {
+	_Alignas(64) pthread_t thread;
+	struct CoopBoard *board;
+	struct CoopPlayer player;
+	long long first;
+	long long last;
+	long long start;
+	long long step;
+	long long moves;
+	long long uncovered;
+	long long flagged;
+	bool failed;
+};
+
+static bool InBounds(const struct CoopBoard *board, int row, int col)
+{
+	return row >= 0 && row < board->rows && col >= 0 && col < board->cols;
+}
+
+static atomic_int *FlagCounter(struct CoopBoard *board, int index)
+{
+	// Spread the flag count over counters a cache line apart, so players
+	// flagging in different places don't all fight over one.
+	return &board->minesFlagged[(index / board->cols) % COOP_COUNTERS].value;
+}
+
+bool CoopBoardInit(struct CoopBoard *board, int rows, int cols, int mines, unsigned seed)
+{
+	long long count = (long long) rows * cols;
+
+	memset(board, 0, sizeof(*board));
+
+	if (rows < 1 || cols < 1 || count > INT_MAX || mines < 0 || mines >= count)
+	{
+		return false;
+	}
+
+	board->tiles = calloc(count, sizeof(*board->tiles));
+
+	if (board->tiles == NULL)
+	{
+		return false;
+	}
+
+	board->rows = rows;
+	board->cols = cols;
+	board->mines = mines;
+
+	// Place the mines the way the engine does. Nobody else can see the
+	// board yet, so none of this needs to be more than relaxed.
+	struct random_data random;
+	char randomState[128];
+	int32_t value;
+
+	memset(&random, 0, sizeof(random));
+	initstate_r(seed, randomState, sizeof(randomState), &random);
+
+	for (int i = 0; i < mines; i++)
+	{
+		random_r(&random, &value);
+		int mineRow = value % rows;
+		random_r(&random, &value);
+		int mineCol = value % cols;
+		atomic_uchar *tile = &board->tiles[mineRow * cols + mineCol];
+
+		if (atomic_load_explicit(tile, memory_order_relaxed) & COOP_MINE)
+		{
+			i--;
+		}
+		else
+		{
+			atomic_store_explicit(tile, COOP_MINE, memory_order_relaxed);
+		}
+	}
+
+	// Count each mine on the tiles around it that aren't mines.
+	for (int i = 0; i < count; i++)
+	{
+		if (!(atomic_load_explicit(&board->tiles[i], memory_order_relaxed) & COOP_MINE))
+		{
+			continue;
+		}
+
+		for (int di = -1; di <= 1; di++)
+		{
+			for (int dj = -1; dj <= 1; dj++)
+			{
+				int ni = i / cols + di;
+				int nj = i % cols + dj;
+
+				if ((di != 0 || dj != 0) && InBounds(board, ni, nj))
+				{
+					atomic_uchar *tile = &board->tiles[ni * cols + nj];
+					unsigned char old = atomic_load_explicit(tile, memory_order_relaxed);
+
+					if (!(old & COOP_MINE))
+					{
+						atomic_store_explicit(tile, old + 1, memory_order_relaxed);
+					}
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+void CoopBoardFree(struct CoopBoard *board)
+{
+	free(board->tiles);
+	board->tiles = NULL;
+}
+
+static bool Claim(struct CoopBoard *board, int index)
+{
+	// Uncover a tile that's covered and not flagged, unless another
+	// player gets there first. Whoever uncovers it owns it.
+	unsigned char tile = atomic_load_explicit(&board->tiles[index], memory_order_relaxed);
+
+	while (!(tile & (COOP_UNCOVERED | COOP_FLAGGED)))
+	{
+		if (atomic_compare_exchange_weak_explicit(&board->tiles[index], &tile, tile | COOP_UNCOVERED,
+												  memory_order_relaxed, memory_order_relaxed))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+static bool Push(struct CoopPlayer *player, int *top, int index)
+{
+	if (*top == player->stackSize)
+	{
+		int size = player->stackSize > 0 ? player->stackSize * 2 : 1024;
+		int *stack = realloc(player->stack, size * sizeof(*stack));
+
+		if (stack == NULL)
+		{
+			return false;
+		}
+
+		player->stack = stack;
+		player->stackSize = size;
+	}
+
+	player->stack[(*top)++] = index;
+	return true;
+}
+
+int CoopReveal(struct CoopBoard *board, struct CoopPlayer *player, int row, int col)
+{
+	if (!InBounds(board, row, col) || !Claim(board, row * board->cols + col))
+	{
+		return 0;
+	}
+
+	unsigned char tile = atomic_load_explicit(&board->tiles[row * board->cols + col], memory_order_relaxed);
+
+	if (tile & COOP_MINE)
+	{
+		atomic_fetch_add(&board->minesUncovered, 1);
+		return 1;
+	}
+
+	// Open up around an empty tile, and around every empty tile that
+	// uncovers, but only the ones this player uncovered. None of the
+	// tiles around an empty tile are mines.
+	int uncovered = 1;
+	int top = 0;
+
+	if ((tile & COOP_ADJACENT) == 0 && !Push(player, &top, row * board->cols + col))
+	{
+		return -1;
+	}
+
+	while (top > 0)
+	{
+		int index = player->stack[--top];
+		int i = index / board->cols;
+		int j = index % board->cols;
+
+		for (int di = -1; di <= 1; di++)
+		{
+			for (int dj = -1; dj <= 1; dj++)
+			{
+				int neighbour = (i + di) * board->cols + j + dj;
+
+				if ((di == 0 && dj == 0) || !InBounds(board, i + di, j + dj) || !Claim(board, neighbour))
+				{
+					continue;
+				}
+
+				uncovered++;
+
+				if ((atomic_load_explicit(&board->tiles[neighbour], memory_order_relaxed) & COOP_ADJACENT) == 0 &&
+					!Push(player, &top, neighbour))
+				{
+					return -1;
+				}
+			}
+		}
+	}
+
+	return uncovered;
+}
+
+int CoopFlag(struct CoopBoard *board, int row, int col, bool flagged)
+{
+	if (!InBounds(board, row, col))
+	{
+		return 0;
+	}
+
+	int index = row * board->cols + col;
+	unsigned char tile = atomic_load_explicit(&board->tiles[index], memory_order_relaxed);
+
+	while (!(tile & COOP_UNCOVERED) && ((tile & COOP_FLAGGED) != 0) != flagged)
+	{
+		if (atomic_compare_exchange_weak_explicit(&board->tiles[index], &tile, tile ^ COOP_FLAGGED,
+												  memory_order_relaxed, memory_order_relaxed))
+		{
+			if (tile & COOP_MINE)
+			{
+				atomic_fetch_add_explicit(FlagCounter(board, index), flagged ? 1 : -1, memory_order_relaxed);
+			}
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+bool CoopWon(struct CoopBoard *board)
+{
+	int flagged = 0;
+
+	for (int i = 0; i < COOP_COUNTERS; i++)
+	{
+		flagged += atomic_load(&board->minesFlagged[i].value);
+	}
+
+	return flagged == board->mines && !CoopLost(board);
+}
+
+bool CoopLost(struct CoopBoard *board)
+{
+	return atomic_load(&board->minesUncovered) > 0;
+}
+
+void CoopPlayerFree(struct CoopPlayer *player)
+{
+	free(player->stack);
+	player->stack = NULL;
+	player->stackSize = 0;
+}
+
+static long long Gcd(long long a, long long b)
+{
+	while (b != 0)
+	{
+		long long r = a % b;
+		a = b;
+		b = r;
+	}
+
+	return a;
+}
+
+static void *CoopWorkerThread(void *arg)
+{
+	// Play as someone who can see the mines: flag each mine and uncover
+	// each tile that isn't uncovered yet. Every tile is someone's to
+	// visit, but floods run on into everyone else's.
+	struct CoopWorker *worker = arg;
+	struct CoopBoard *board = worker->board;
+	long long count = (long long) board->rows * board->cols;
+
+	for (long long i = worker->first; i < worker->last; i++)
+	{
+		long long index = (worker->start + i * worker->step) % count;
+		int row = index / board->cols;
+		int col = index % board->cols;
+		unsigned char tile = atomic_load_explicit(&board->tiles[index], memory_order_relaxed);
+
+		if (tile & COOP_MINE)
+		{
+			worker->flagged += CoopFlag(board, row, col, true);
+		}
+		else if (!(tile & COOP_UNCOVERED))
+		{
+			int uncovered = CoopReveal(board, &worker->player, row, col);
+
+			if (uncovered < 0)
+			{
+				worker->failed = true;
+				break;
+			}
+
+			worker->moves++;
+			worker->uncovered += uncovered;
+		}
+	}
+
+	return NULL;
+}
+
+void CoopBenchmark(int side)
+{
+	struct CoopWorker workers[COOP_MAX_PLAYERS];
+	struct CoopBoard board;
+	long long count = (long long) side * side;
+	int mines = count * COOP_MINE_PERCENT / 100;
+	unsigned pick = COOP_SEED;
+
+	memset(workers, 0, sizeof(workers));
+
+	for (int players = 1; players <= COOP_MAX_PLAYERS; players *= 2)
+	{
+		long long dealStart = MonotonicNanos();
+
+		if (!CoopBoardInit(&board, side, side, mines, COOP_SEED))
+		{
+			fprintf(stderr, "Can't deal a %d by %d board\n", side, side);
+			exit(EXIT_FAILURE);
+		}
+
+		if (players == 1)
+		{
+			printf("%d by %d board with %d mines dealt in %.2f s\n", side, side, mines,
+				   (MonotonicNanos() - dealStart) / 1e9);
+		}
+
+		// Shuffle the tiles without keeping a list of them, by starting
+		// somewhere and stepping through the board by an amount that
+		// visits every tile before coming back, and deal each player an
+		// even share of that order.
+		long long start = rand_r(&pick) % count;
+		long long step = rand_r(&pick) % count;
+
+		while (Gcd(step, count) != 1)
+		{
+			step++;
+		}
+
+		for (int i = 0; i < players; i++)
+		{
+			workers[i].board = &board;
+			workers[i].first = count * i / players;
+			workers[i].last = count * (i + 1) / players;
+			workers[i].start = start;
+			workers[i].step = step;
+			workers[i].moves = 0;
+			workers[i].uncovered = 0;
+			workers[i].flagged = 0;
+		}
+
+		long long clearStart = MonotonicNanos();
+
+		for (int i = 0; i < players; i++)
+		{
+			if (pthread_create(&workers[i].thread, NULL, CoopWorkerThread, &workers[i]) != 0)
+			{
+				perror("thread creation failed");
+				exit(EXIT_FAILURE);
+			}
+		}
+
+		long long moves = 0;
+		long long uncovered = 0;
+		long long flagged = 0;
+		bool failed = false;
+
+		for (int i = 0; i < players; i++)
+		{
+			pthread_join(workers[i].thread, NULL);
+			moves += workers[i].moves;
+			uncovered += workers[i].uncovered;
+			flagged += workers[i].flagged;
+			failed = failed || workers[i].failed;
+		}
+
+		double elapsed = (MonotonicNanos() - clearStart) / 1e9;
+
+		printf("%2d players: cleared in %.2f s, %.0f tiles uncovered/sec, %.0f reveals/sec\n", players, elapsed,
+			   uncovered / elapsed, moves / elapsed);
+
+		// Between them the players must have uncovered every safe tile
+		// exactly once and flagged every mine.
+		if (failed || uncovered != count - mines || flagged != mines || !CoopWon(&board))
+		{
+			fprintf(stderr, "%d players left the board wrong: %lld uncovered, %lld flagged\n", players, uncovered,
+					flagged);
+			exit(1);
+		}
+
+		CoopBoardFree(&board);
+	}
+
+	for (int i = 0; i < COOP_MAX_PLAYERS; i++)
+	{
+		CoopPlayerFree(&workers[i].player);
+	}
+}
@@ -0,0 +1,73 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - cooperative play on one huge board
+
+#ifndef COOP_H
+#define COOP_H
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+// Any number of players, each on a thread of their own, clearing one
+// board together. Boards can be thousands of tiles on a side, so each
+// tile is a single byte: its mine count in the low bits, then whether
+// it's a mine, flagged and uncovered.
+//
+// Nothing is ever locked. Every change to a tile is a compare and swap
+// on its byte, so two players can't both uncover it, or flag a tile as
+// it's uncovered. A flood fill owns exactly the tiles it uncovered
+// itself, and only opens up around those, so floods from different
+// players can run into each other anywhere on the board without either
+// waiting on the other. Between them they uncover every tile once.
+
+#define COOP_ADJACENT 0x0f
+#define COOP_MINE 0x10
+#define COOP_FLAGGED 0x20
+#define COOP_UNCOVERED 0x40
+#define COOP_COUNTERS 64
+
+// A count kept on a cache line of its own.
+struct CoopCounter {
+	atomic_int value;
+	char padding[64 - sizeof(atomic_int)];
+};
+
+struct CoopBoard {
+	int rows;
+	int cols;
+	int mines;
+	atomic_uchar *tiles;
+	// Mines flagged, split by row across COOP_COUNTERS counters, and
+	// mines uncovered, across all players.
+	struct CoopCounter minesFlagged[COOP_COUNTERS];
+	atomic_int minesUncovered;
+};
+
+// One player's work stack for flood fills, grown as needed.
+struct CoopPlayer {
+	int *stack;
+	int stackSize;
+};
+
+// Deal a board from seed. Returns false if it can't be allocated or
+// the mines don't fit.
+bool CoopBoardInit(struct CoopBoard *board, int rows, int cols, int mines, unsigned seed);
+void CoopBoardFree(struct CoopBoard *board);
+
+// Uncover a tile, and everything around it if it's empty, the same as
+// MinefieldReveal() except that flagged tiles are left alone. Returns
+// how many tiles this player uncovered, or -1 if the stack couldn't
+// grow.
+int CoopReveal(struct CoopBoard *board, struct CoopPlayer *player, int row, int col);
+// Flag or unflag a covered tile. Returns 1 if that changed it.
+int CoopFlag(struct CoopBoard *board, int row, int col, bool flagged);
+bool CoopWon(struct CoopBoard *board);
+bool CoopLost(struct CoopBoard *board);
+void CoopPlayerFree(struct CoopPlayer *player);
+
+// Clear a side by side board with 1, 2, 4 and so on up to 64 players
+// and report the tiles uncovered per second for each.
+void CoopBenchmark(int side);
+
+#endif
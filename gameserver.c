@@ -0,0 +1,1090 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - headless game server
+
+#include <poll.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+
+#include "stats.h"
+#include "minefield.h"
+#include "boardpool.h"
+#include "gameserver.h"
+
+#define SERVER_EVENTS 256
+
+// Once this much is waiting to be sent to a client, its requests are
+// left unread until it catches up, so a client that never reads its
+// replies can't make the server buffer without end.
+#define SERVER_OUTPUT_LIMIT 65536
+
+// The load generator's games, and how many requests it keeps in flight
+// on each connection.
+#define LOAD_SECONDS 5
+#define LOAD_WARMUP_SECONDS 1
+#define LOAD_WINDOW 64
+#define LOAD_ROWS 16
+#define LOAD_COLS 16
+#define LOAD_MINES 40
+#define LOAD_REQUEST_LENGTH 32
+
+// One connection and the game it's playing. The board's memory is
+// kept between games unless a bigger board is dealt, and a closed
+// session goes on a free list, output buffer and all, for the next
+// connection.
+struct Session {
+	struct Session *next;
+	int fd;
+	uint32_t events;
+	bool hasBoard;
+	struct Minefield field;
+	struct BoardMemory *board;
+	char input[GAME_SERVER_LINE_LENGTH];
+	int inputLength;
+	char *output;
+	size_t outputLength;
+	size_t outputSent;
+	size_t outputSize;
+};
+
+// One of the load generator's connections. It deals each board itself
+// as well, so it knows where the mines are and can send a whole game's
+// moves without waiting to see how each one went.
+struct LoadConnection {
+	int fd;
+	unsigned seed;
+	struct Minefield field;
+	struct Tile tiles[LOAD_ROWS * LOAD_COLS];
+	int work[LOAD_ROWS * LOAD_COLS];
+	int touched[LOAD_ROWS * LOAD_COLS];
+	int order[LOAD_ROWS * LOAD_COLS];
+	int next;
+	bool dealt;
+	char output[LOAD_WINDOW * LOAD_REQUEST_LENGTH];
+	int outputLength;
+	int outputSent;
+	// What was asked for by each request still waiting on its reply.
+	char kinds[LOAD_WINDOW];
+	int firstKind;
+	int inFlight;
+	char reply[3];
+	int replyLength;
+};
+
+struct LoadTotals {
+	long long moves;
+	long long games;
+	long long wins;
+	long long errors;
+};
+
+static int epollFd;
+static volatile sig_atomic_t stopping;
+static long long sessionsServed;
+static long long sessionsOpen;
+static long long sessionsPeak;
+static long long movesServed;
+static long long errorsServed;
+static struct Histogram requestTime;
+
+// Boards and sessions are recycled rather than freed. heapAllocations
+// counts every trip to the heap the server makes besides the pool's,
+// so the two together show whether playing is allocating.
+static struct BoardPool boardPool;
+static struct Session *freeSessions;
+static long long heapAllocations;
+
+static void StopServer(int sig)
+{
+	stopping = true;
+}
+
+static int ListenOn(const char *path)
+{
+	struct sockaddr_un address;
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+	if (listener < 0 || strlen(path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "Can't listen on %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	// A socket file left behind by a server that's gone can be replaced,
+	// but not one that another server is still answering on.
+	int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (connect(probe, (struct sockaddr *) &address, sizeof(address)) == 0)
+	{
+		fprintf(stderr, "A server is already running on %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	close(probe);
+	unlink(path);
+
+	if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, SOMAXCONN) != 0)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	return listener;
+}
+
+static void Watch(struct Session *session)
+{
+	// Wait for requests while there's room for their replies, and for
+	// the socket to drain while there's anything left to send.
+	size_t backlog = session->outputLength - session->outputSent;
+	uint32_t events = 0;
+
+	if (backlog < SERVER_OUTPUT_LIMIT)
+	{
+		events |= EPOLLIN;
+	}
+
+	if (backlog > 0)
+	{
+		events |= EPOLLOUT;
+	}
+
+	if (events != session->events)
+	{
+		struct epoll_event event = { events, { .ptr = session } };
+
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, session->fd, &event);
+		session->events = events;
+	}
+}
+
+static void AcceptSessions(int listener)
+{
+	int client;
+
+	while ((client = accept(listener, NULL, NULL)) >= 0)
+	{
+		fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+
+		struct Session *session = freeSessions;
+
+		if (session != NULL)
+		{
+			freeSessions = session->next;
+		}
+		else if ((session = calloc(1, sizeof(*session))) != NULL)
+		{
+			heapAllocations++;
+		}
+
+		struct epoll_event event = { EPOLLIN, { .ptr = session } };
+
+		if (session == NULL || epoll_ctl(epollFd, EPOLL_CTL_ADD, client, &event) != 0)
+		{
+			if (session != NULL)
+			{
+				session->next = freeSessions;
+				freeSessions = session;
+			}
+
+			close(client);
+			continue;
+		}
+
+		session->fd = client;
+		session->events = EPOLLIN;
+		session->hasBoard = false;
+		session->inputLength = 0;
+		session->outputLength = 0;
+		session->outputSent = 0;
+
+		sessionsServed++;
+		sessionsOpen++;
+
+		if (sessionsOpen > sessionsPeak)
+		{
+			sessionsPeak = sessionsOpen;
+		}
+	}
+}
+
+static void CloseSession(struct Session *session)
+{
+	// Closing the socket takes it out of the epoll set as well. The
+	// board and the session are kept for whoever connects next.
+	close(session->fd);
+
+	BoardPoolGive(&boardPool, session->board);
+	session->board = NULL;
+
+	session->next = freeSessions;
+	freeSessions = session;
+
+	sessionsOpen--;
+}
+
+static bool MakeRoom(struct Session *session, size_t length)
+{
+	// Make sure another length bytes of output fit.
+	if (session->outputSent == session->outputLength)
+	{
+		session->outputSent = 0;
+		session->outputLength = 0;
+	}
+
+	if (session->outputLength + length <= session->outputSize)
+	{
+		return true;
+	}
+
+	size_t size = session->outputSize > 0 ? session->outputSize : 4096;
+
+	while (size < session->outputLength + length)
+	{
+		size *= 2;
+	}
+
+	char *output = realloc(session->output, size);
+
+	if (output == NULL)
+	{
+		return false;
+	}
+
+	session->output = output;
+	session->outputSize = size;
+	heapAllocations++;
+	return true;
+}
+
+static void Reply(struct Session *session, const char *text)
+{
+	size_t length = strlen(text);
+
+	if (text[0] == 'E')
+	{
+		errorsServed++;
+	}
+
+	if (MakeRoom(session, length))
+	{
+		memcpy(session->output + session->outputLength, text, length);
+		session->outputLength += length;
+	}
+}
+
+static char *PutNumber(char *at, int value)
+{
+	// Write a number out without going through printf.
+	char digits[12];
+	int count = 0;
+
+	if (value < 0)
+	{
+		*at++ = '-';
+		value = -value;
+	}
+
+	do
+	{
+		digits[count++] = '0' + value % 10;
+		value /= 10;
+	} while (value > 0);
+
+	while (count > 0)
+	{
+		*at++ = digits[--count];
+	}
+
+	return at;
+}
+
+static char GameState(const struct Minefield *field)
+{
+	return field->lost ? 'L' : field->won ? 'W' : 'P';
+}
+
+static void ReplyChanges(struct Session *session)
+{
+	// Send how the game stands and every tile the last request changed.
+	struct Minefield *field = &session->field;
+
+	if (!MakeRoom(session, 32 + (size_t) field->changeCount * 16))
+	{
+		field->changeCount = 0;
+		return;
+	}
+
+	char *at = session->output + session->outputLength;
+
+	*at++ = '=';
+	*at++ = ' ';
+	*at++ = GameState(field);
+	*at++ = ' ';
+	at = PutNumber(at, field->mines - field->flags);
+	*at++ = ' ';
+	at = PutNumber(at, field->changeCount);
+
+	for (int i = 0; i < field->changeCount; i++)
+	{
+		int index = field->changes[i];
+
+		*at++ = ' ';
+		at = PutNumber(at, index / field->cols);
+		*at++ = ':';
+		at = PutNumber(at, index % field->cols);
+		*at++ = ':';
+		*at++ = MinefieldTileCharacter(&field->tiles[index]);
+	}
+
+	*at++ = '\n';
+
+	session->outputLength = at - session->output;
+	field->changeCount = 0;
+}
+
+static bool ParseNumbers(const char *text, int *values, int count)
+{
+	// Read exactly count whole numbers separated by spaces.
+	for (int i = 0; i < count; i++)
+	{
+		char *end;
+		long value = strtol(text, &end, 10);
+
+		if (end == text || value < 0 || value > 0x7fffffff)
+		{
+			return false;
+		}
+
+		values[i] = value;
+		text = end;
+	}
+
+	return *text == '\0';
+}
+
+static void HandleNew(struct Session *session, const char *arguments)
+{
+	int values[4];
+
+	if (!ParseNumbers(arguments, values, 4) || values[0] < 1 || values[0] > GAME_SERVER_MAX_SIDE ||
+		values[1] < 1 || values[1] > GAME_SERVER_MAX_SIDE)
+	{
+		Reply(session, "E expected N rows cols mines seed\n");
+		return;
+	}
+
+	int size = values[0] * values[1];
+	bool fresh = session->board == NULL || session->board->capacity < size;
+
+	if (fresh)
+	{
+		BoardPoolGive(&boardPool, session->board);
+		session->board = BoardPoolTake(&boardPool, size);
+		session->hasBoard = false;
+
+		if (session->board == NULL)
+		{
+			Reply(session, "E out of memory\n");
+			return;
+		}
+	}
+
+	// A board of the same size as the last one is dealt over it, which
+	// only has to clear the tiles the last game touched.
+	if (fresh || session->field.rows != values[0] || session->field.cols != values[1])
+	{
+		MinefieldInit(&session->field, values[0], values[1], session->board->tiles, session->board->work);
+		MinefieldTrackChanges(&session->field, session->board->changes);
+		MinefieldKeepTouched(&session->field, session->board->touched);
+	}
+
+	session->hasBoard = MinefieldReset(&session->field, values[2], values[3]);
+
+	if (!session->hasBoard)
+	{
+		Reply(session, "E too many mines\n");
+		return;
+	}
+
+	ReplyChanges(session);
+}
+
+static void HandleMove(struct Session *session, char move, const char *arguments)
+{
+	struct Minefield *field = &session->field;
+	int values[2];
+
+	if (!session->hasBoard)
+	{
+		Reply(session, "E no board\n");
+		return;
+	}
+
+	if (!ParseNumbers(arguments, values, 2) || values[0] >= field->rows || values[1] >= field->cols)
+	{
+		Reply(session, "E no such tile\n");
+		return;
+	}
+
+	if (field->won || field->lost)
+	{
+		Reply(session, "E game over\n");
+		return;
+	}
+
+	switch (move)
+	{
+		case 'R':
+			MinefieldReveal(field, values[0], values[1]);
+			break;
+
+		case 'F':
+			MinefieldFlag(field, values[0], values[1]);
+			break;
+
+		case 'C':
+			MinefieldChord(field, values[0], values[1]);
+			break;
+	}
+
+	movesServed++;
+	ReplyChanges(session);
+}
+
+static void HandleBoard(struct Session *session)
+{
+	struct Minefield *field = &session->field;
+
+	if (!session->hasBoard)
+	{
+		Reply(session, "E no board\n");
+		return;
+	}
+
+	if (!MakeRoom(session, 64 + (size_t) field->rows * (field->cols + 1)))
+	{
+		return;
+	}
+
+	char *at = session->output + session->outputLength;
+
+	at += sprintf(at, "B %d %d %c %d ", field->rows, field->cols, GameState(field), field->mines - field->flags);
+
+	for (int i = 0; i < field->rows; i++)
+	{
+		for (int j = 0; j < field->cols; j++)
+		{
+			*at++ = MinefieldTileCharacter(MinefieldTile(field, i, j));
+		}
+
+		*at++ = i < field->rows - 1 ? '/' : '\n';
+	}
+
+	session->outputLength = at - session->output;
+}
+
+static void HandleRequest(struct Session *session, char *line)
+{
+	long long start = MonotonicNanos();
+
+	if (line[0] == 'N' && line[1] == ' ')
+	{
+		HandleNew(session, line + 2);
+	}
+	else if ((line[0] == 'R' || line[0] == 'F' || line[0] == 'C') && line[1] == ' ')
+	{
+		HandleMove(session, line[0], line + 2);
+	}
+	else if ((line[0] == 'S' && line[1] == '\0') || strcmp(line, "STATE") == 0)
+	{
+		HandleBoard(session);
+	}
+	else if (line[0] == 'I' && line[1] == '\0')
+	{
+		char text[160];
+
+		snprintf(text, sizeof(text), "I %lld %lld %lld %lld %lld\n", sessionsOpen, movesServed,
+				 heapAllocations + boardPool.allocations, boardPool.takes, boardPool.recycled);
+		Reply(session, text);
+	}
+	else
+	{
+		Reply(session, "E unknown request\n");
+	}
+
+	HistogramRecord(&requestTime, MonotonicNanos() - start);
+}
+
+static bool HandleInput(struct Session *session)
+{
+	// Answer each whole line that's come in, as long as there's room for
+	// the replies. Returns false if the client sent a line too long to be
+	// a request.
+	char *start = session->input;
+	char *end = session->input + session->inputLength;
+	char *newline;
+
+	while (session->outputLength - session->outputSent < SERVER_OUTPUT_LIMIT &&
+		   (newline = memchr(start, '\n', end - start)) != NULL)
+	{
+		*newline = '\0';
+		HandleRequest(session, start);
+		start = newline + 1;
+	}
+
+	session->inputLength = end - start;
+	memmove(session->input, start, session->inputLength);
+
+	return session->inputLength < (int) sizeof(session->input);
+}
+
+static bool Flush(struct Session *session)
+{
+	// Send as much of the output as the socket will take right now.
+	while (session->outputSent < session->outputLength)
+	{
+		ssize_t sent = send(session->fd, session->output + session->outputSent,
+							session->outputLength - session->outputSent, MSG_NOSIGNAL);
+
+		if (sent < 0)
+		{
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+
+		session->outputSent += sent;
+	}
+
+	return true;
+}
+
+static void ServeSession(struct Session *session, uint32_t events)
+{
+	if (events & EPOLLERR)
+	{
+		CloseSession(session);
+		return;
+	}
+
+	if (events & (EPOLLIN | EPOLLHUP))
+	{
+		ssize_t count = read(session->fd, session->input + session->inputLength,
+							 sizeof(session->input) - session->inputLength);
+
+		if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+		{
+			CloseSession(session);
+			return;
+		}
+
+		if (count > 0)
+		{
+			session->inputLength += count;
+		}
+	}
+
+	// Answer what's been read, and anything left unread last time
+	// because the client was behind on its replies.
+	if (!Flush(session) || !HandleInput(session) || !Flush(session))
+	{
+		CloseSession(session);
+		return;
+	}
+
+	Watch(session);
+}
+
+void GameServerRun(const char *path)
+{
+	struct epoll_event events[SERVER_EVENTS];
+	int listener = ListenOn(path);
+
+	epollFd = epoll_create1(0);
+
+	struct epoll_event event = { EPOLLIN, { .ptr = NULL } };
+
+	if (epollFd < 0 || epoll_ctl(epollFd, EPOLL_CTL_ADD, listener, &event) != 0)
+	{
+		perror("epoll");
+		exit(EXIT_FAILURE);
+	}
+
+	struct sigaction act;
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = StopServer;
+	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGINT, &act, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("Serving games on %s\n", path);
+	fflush(stdout);
+
+	long long start = MonotonicNanos();
+
+	while (!stopping)
+	{
+		int ready = epoll_wait(epollFd, events, SERVER_EVENTS, -1);
+
+		if (ready < 0 && errno != EINTR)
+		{
+			perror("epoll_wait");
+			break;
+		}
+
+		for (int i = 0; i < ready; i++)
+		{
+			if (events[i].data.ptr == NULL)
+			{
+				AcceptSessions(listener);
+			}
+			else
+			{
+				ServeSession(events[i].data.ptr, events[i].events);
+			}
+		}
+	}
+
+	close(listener);
+	unlink(path);
+
+	while (freeSessions != NULL)
+	{
+		struct Session *session = freeSessions;
+
+		freeSessions = session->next;
+		free(session->output);
+		free(session);
+	}
+
+	BoardPoolEmpty(&boardPool);
+
+	double elapsed = (MonotonicNanos() - start) / 1e9;
+
+	printf("Served %lld sessions (%lld at once) and %lld moves in %.2f s\n", sessionsServed, sessionsPeak,
+		   movesServed, elapsed);
+	HistogramPrint(stdout, "request", &requestTime, 1000.0, "us");
+	printf("%lld heap allocations; %lld boards taken from the pool, %lld of them recycled\n",
+		   heapAllocations + boardPool.allocations, boardPool.takes, boardPool.recycled);
+}
+
+static int LoadRequest(struct LoadConnection *connection, char *request)
+{
+	// The next request of a perfect game: deal, then go through the
+	// tiles in a random order flagging mines and uncovering whatever
+	// isn't already. The last mine flagged wins the game.
+	struct Minefield *field = &connection->field;
+
+	if (!connection->dealt || field->won)
+	{
+		int count = LOAD_ROWS * LOAD_COLS;
+		unsigned shuffle = ++connection->seed;
+
+		MinefieldReset(field, LOAD_MINES, connection->seed);
+
+		for (int i = 0; i < count; i++)
+		{
+			int j = rand_r(&shuffle) % (i + 1);
+
+			connection->order[i] = connection->order[j];
+			connection->order[j] = i;
+		}
+
+		connection->next = 0;
+		connection->dealt = true;
+
+		return sprintf(request, "N %d %d %d %u\n", LOAD_ROWS, LOAD_COLS, LOAD_MINES, connection->seed);
+	}
+
+	while (true)
+	{
+		int index = connection->order[connection->next++];
+		int row = index / LOAD_COLS;
+		int col = index % LOAD_COLS;
+
+		if (field->tiles[index].isMine)
+		{
+			MinefieldFlag(field, row, col);
+			return sprintf(request, "F %d %d\n", row, col);
+		}
+
+		if (!field->tiles[index].isFloodFillMarked)
+		{
+			MinefieldReveal(field, row, col);
+			return sprintf(request, "R %d %d\n", row, col);
+		}
+	}
+}
+
+static bool WriteOutput(struct Session *session)
+{
+	// Write everything waiting to go out, blocking until it has.
+	while (session->outputSent < session->outputLength)
+	{
+		ssize_t written = write(session->fd, session->output + session->outputSent,
+								session->outputLength - session->outputSent);
+
+		if (written < 0 && errno != EINTR)
+		{
+			return false;
+		}
+
+		if (written > 0)
+		{
+			session->outputSent += written;
+		}
+	}
+
+	return true;
+}
+
+void GameServerBot()
+{
+	// One session, read from stdin and answered on stdout. Replies are
+	// only written once the buffer is full or there's nothing more to
+	// read for now, so a script piped in goes through in big writes
+	// while a bot waiting on each reply still gets it.
+	struct Session *session = calloc(1, sizeof(*session));
+	ssize_t count = 1;
+
+	if (session == NULL)
+	{
+		perror("Can't start the bot protocol");
+		exit(EXIT_FAILURE);
+	}
+
+	session->fd = STDOUT_FILENO;
+	signal(SIGPIPE, SIG_IGN);
+
+	long long start = MonotonicNanos();
+
+	while (count > 0)
+	{
+		struct pollfd input = { STDIN_FILENO, POLLIN, 0 };
+
+		if (session->outputSent < session->outputLength && poll(&input, 1, 0) == 0 && !WriteOutput(session))
+		{
+			break;
+		}
+
+		count = read(STDIN_FILENO, session->input + session->inputLength,
+					 sizeof(session->input) - session->inputLength);
+
+		if (count < 0 && errno == EINTR)
+		{
+			continue;
+		}
+
+		if (count > 0)
+		{
+			session->inputLength += count;
+		}
+
+		// Answer every whole line, writing out a full buffer whenever
+		// the replies stop to let it drain.
+		bool fits = HandleInput(session);
+
+		while (session->outputLength - session->outputSent >= SERVER_OUTPUT_LIMIT)
+		{
+			if (!WriteOutput(session))
+			{
+				count = 0;
+				break;
+			}
+
+			fits = HandleInput(session);
+		}
+
+		if (!fits)
+		{
+			fprintf(stderr, "A request was too long\n");
+			break;
+		}
+	}
+
+	WriteOutput(session);
+
+	double elapsed = (MonotonicNanos() - start) / 1e9;
+
+	fprintf(stderr, "%lld moves and %lld errors in %.2f s: %.0f moves/sec\n", movesServed, errorsServed,
+			elapsed, movesServed / elapsed);
+	HistogramPrint(stderr, "request", &requestTime, 1000.0, "us");
+
+	BoardPoolGive(&boardPool, session->board);
+	BoardPoolEmpty(&boardPool);
+	free(session->output);
+	free(session);
+}
+
+void GameServerScript(int games)
+{
+	// Write out the requests for games perfect games, the way the load
+	// generator plays them, for piping into the bot protocol.
+	struct LoadConnection *connection = calloc(1, sizeof(*connection));
+	char request[LOAD_REQUEST_LENGTH];
+	int dealt = 0;
+
+	if (connection == NULL)
+	{
+		perror("Can't write the script");
+		exit(EXIT_FAILURE);
+	}
+
+	MinefieldInit(&connection->field, LOAD_ROWS, LOAD_COLS, connection->tiles, connection->work);
+	MinefieldKeepTouched(&connection->field, connection->touched);
+
+	while (true)
+	{
+		int length = LoadRequest(connection, request);
+
+		if (request[0] == 'N' && dealt++ == games)
+		{
+			break;
+		}
+
+		fwrite(request, 1, length, stdout);
+	}
+
+	fflush(stdout);
+	free(connection);
+}
+
+static int ConnectTo(const char *path)
+{
+	struct sockaddr_un address;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+	if (fd < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	return fd;
+}
+
+static void PlayLoad(struct LoadConnection *load, struct pollfd *polls, int connections, long long nanos,
+					 struct LoadTotals *totals)
+{
+	char buffer[65536];
+
+	memset(totals, 0, sizeof(*totals));
+
+	long long stop = MonotonicNanos() + nanos;
+	long long inFlight = 0;
+
+	// Keep every connection's window full until time's up, then wait for
+	// the replies still owed.
+	while (MonotonicNanos() < stop || inFlight > 0)
+	{
+		bool sending = MonotonicNanos() < stop;
+
+		for (int i = 0; i < connections; i++)
+		{
+			struct LoadConnection *connection = &load[i];
+
+			while (sending && connection->inFlight < LOAD_WINDOW &&
+				   connection->outputLength + LOAD_REQUEST_LENGTH <= (int) sizeof(connection->output))
+			{
+				char *request = connection->output + connection->outputLength;
+				int length = LoadRequest(connection, request);
+
+				connection->kinds[(connection->firstKind + connection->inFlight) % LOAD_WINDOW] = request[0];
+				connection->inFlight++;
+				connection->outputLength += length;
+				inFlight++;
+			}
+
+			if (connection->outputSent < connection->outputLength)
+			{
+				ssize_t sent = send(connection->fd, connection->output + connection->outputSent,
+									connection->outputLength - connection->outputSent, MSG_NOSIGNAL);
+
+				if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+				{
+					perror("send");
+					exit(EXIT_FAILURE);
+				}
+
+				connection->outputSent += sent > 0 ? sent : 0;
+
+				if (connection->outputSent == connection->outputLength)
+				{
+					connection->outputSent = 0;
+					connection->outputLength = 0;
+				}
+			}
+
+			polls[i].fd = connection->fd;
+			polls[i].events = POLLIN | (connection->outputLength > 0 ? POLLOUT : 0);
+		}
+
+		if (poll(polls, connections, 1000) <= 0)
+		{
+			continue;
+		}
+
+		for (int i = 0; i < connections; i++)
+		{
+			struct LoadConnection *connection = &load[i];
+
+			if (!(polls[i].revents & (POLLIN | POLLHUP | POLLERR)))
+			{
+				continue;
+			}
+
+			ssize_t count = read(connection->fd, buffer, sizeof(buffer));
+
+			if (count == 0 || (count < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
+			{
+				fprintf(stderr, "The server hung up\n");
+				exit(EXIT_FAILURE);
+			}
+
+			// Only the start of each reply matters: whether it's an
+			// error, and whether the game's been won.
+			for (ssize_t j = 0; j < count; j++)
+			{
+				if (buffer[j] != '\n')
+				{
+					if (connection->replyLength < (int) sizeof(connection->reply))
+					{
+						connection->reply[connection->replyLength++] = buffer[j];
+					}
+
+					continue;
+				}
+
+				char kind = connection->kinds[connection->firstKind];
+
+				connection->firstKind = (connection->firstKind + 1) % LOAD_WINDOW;
+				connection->inFlight--;
+				inFlight--;
+
+				if (connection->reply[0] == 'E')
+				{
+					totals->errors++;
+				}
+				else if (kind == 'N')
+				{
+					totals->games++;
+				}
+				else
+				{
+					totals->moves++;
+					totals->wins += connection->replyLength == 3 && connection->reply[2] == 'W';
+				}
+
+				connection->replyLength = 0;
+			}
+		}
+	}
+}
+
+static void QueryServer(const char *path, long long *moves, long long *allocations)
+{
+	// Ask the server for its counters on a connection of its own.
+	char reply[160];
+	int fd = ConnectTo(path);
+	int length = 0;
+	struct pollfd wait = { fd, POLLIN, 0 };
+
+	send(fd, "I\n", 2, MSG_NOSIGNAL);
+
+	while (length < (int) sizeof(reply) - 1 && poll(&wait, 1, 1000) > 0)
+	{
+		ssize_t count = read(fd, reply + length, sizeof(reply) - 1 - length);
+
+		if (count <= 0)
+		{
+			break;
+		}
+
+		length += count;
+
+		if (reply[length - 1] == '\n')
+		{
+			break;
+		}
+	}
+
+	reply[length] = '\0';
+	close(fd);
+
+	if (sscanf(reply, "I %*d %lld %lld", moves, allocations) != 2)
+	{
+		fprintf(stderr, "The server didn't say how it's doing\n");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void GameServerLoad(const char *path, int connections)
+{
+	struct LoadConnection *load = calloc(connections, sizeof(*load));
+	struct pollfd *polls = calloc(connections, sizeof(*polls));
+	struct LoadTotals totals;
+	long long movesBefore;
+	long long movesAfter;
+	long long allocationsBefore;
+	long long allocationsAfter;
+
+	if (load == NULL || polls == NULL)
+	{
+		perror("Can't start the load");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < connections; i++)
+	{
+		load[i].fd = ConnectTo(path);
+		load[i].seed = i * 1000003u;
+		MinefieldInit(&load[i].field, LOAD_ROWS, LOAD_COLS, load[i].tiles, load[i].work);
+		MinefieldKeepTouched(&load[i].field, load[i].touched);
+	}
+
+	// Warm the server up first, so everything it needs has been
+	// allocated before the moves are counted. That includes the session
+	// the counts are asked for on, whose reply buffer is only allocated
+	// after the first count is taken.
+	QueryServer(path, &movesBefore, &allocationsBefore);
+	PlayLoad(load, polls, connections, LOAD_WARMUP_SECONDS * 1000000000LL, &totals);
+	QueryServer(path, &movesBefore, &allocationsBefore);
+
+	long long start = MonotonicNanos();
+	PlayLoad(load, polls, connections, LOAD_SECONDS * 1000000000LL, &totals);
+	double elapsed = (MonotonicNanos() - start) / 1e9;
+
+	QueryServer(path, &movesAfter, &allocationsAfter);
+
+	printf("%d connections: %lld moves, %lld games dealt, %lld won, %lld errors in %.2f s: %.0f moves/sec\n",
+		   connections, totals.moves, totals.games, totals.wins, totals.errors, elapsed, totals.moves / elapsed);
+	printf("server: %lld heap allocations in %lld moves\n", allocationsAfter - allocationsBefore,
+		   movesAfter - movesBefore);
+
+	for (int i = 0; i < connections; i++)
+	{
+		close(load[i].fd);
+	}
+
+	free(load);
+	free(polls);
+}
@@ -0,0 +1,54 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - headless game server
+
+#ifndef GAMESERVER_H
+#define GAMESERVER_H
+
+// Serves any number of games at once over a UNIX socket, one to each
+// connection, from a single epoll loop. Requests and replies are lines
+// of text, and a client can send as many requests as it likes before
+// reading the replies, which come back in order.
+//
+//   N rows cols mines seed   deal a new board
+//   R row col                reveal a tile
+//   F row col                flag or unflag a tile
+//   C row col                chord around a number
+//   S or STATE               the whole board
+//   I                        how the server is doing
+//
+// N, R, F and C answer with what changed:
+//
+//   = state minesLeft count row:col:tile ...
+//
+// where state is P while the game is being played, W once it's won and
+// L once it's lost, and each tile is 0 to 8, X for an uncovered mine, F
+// for a flag or - for a covered tile. S answers with
+//
+//   B rows cols state minesLeft row/row/...
+//
+// with a character per tile. I answers with
+//
+//   I sessions moves allocations boardsTaken boardsRecycled
+//
+// where allocations counts every trip the server has made to the heap.
+// Anything wrong is answered with "E message".
+
+#define GAME_SERVER_MAX_SIDE 256
+#define GAME_SERVER_LINE_LENGTH 4096
+
+void GameServerRun(const char *path);
+// Play perfect games over the given number of connections for a few
+// seconds, keeping a window of requests in flight on each, and report
+// the moves per second the server kept up.
+void GameServerLoad(const char *path, int connections);
+// Play one game after another over stdin and stdout with the same
+// requests, for bots that drive the engine through a pipe, and report
+// the moves per second on stderr at the end.
+void GameServerBot();
+// Write the requests for the given number of perfect games to stdout,
+// as the load generator plays them, for piping into GameServerBot().
+void GameServerScript(int games);
+
+#endif
@@ -0,0 +1,190 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - lockstep input logs
+
+#include <string.h>
+
+#include "lockstep.h"
+
+static bool PutByte(struct LockstepLog *log, unsigned char byte)
+{
+	if (log->length == LOCKSTEP_LENGTH)
+	{
+		return false;
+	}
+
+	log->data[log->length++] = byte;
+	return true;
+}
+
+static bool PutVarint(struct LockstepLog *log, unsigned long long value)
+{
+	// Seven bits per byte, low bits first, with the top bit set on
+	// every byte but the last.
+	do
+	{
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+
+		if (!PutByte(log, value != 0 ? byte | 0x80 : byte))
+		{
+			return false;
+		}
+	} while (value != 0);
+
+	return true;
+}
+
+int LockstepApply(struct Minefield *field, const struct LockstepInput *input)
+{
+	switch (input->action)
+	{
+		case LOCKSTEP_REVEAL:
+			return MinefieldReveal(field, input->row, input->col);
+
+		case LOCKSTEP_FLAG:
+			return MinefieldFlag(field, input->row, input->col);
+
+		case LOCKSTEP_CHORD:
+			return MinefieldChord(field, input->row, input->col);
+	}
+
+	return 0;
+}
+
+void LockstepReset(struct LockstepLog *log, unsigned seed, int rows, int cols, int mines, int checkEvery)
+{
+	log->seed = seed;
+	log->rows = rows;
+	log->cols = cols;
+	log->mines = mines;
+	log->checkEvery = checkEvery;
+	log->inputs = 0;
+	log->length = 0;
+	log->full = false;
+	log->lastTick = 0;
+	log->lastTile = 0;
+}
+
+bool LockstepAppend(struct LockstepLog *log, const struct Minefield *field, const struct LockstepInput *input)
+{
+	// Store the input relative to the one before it, with the tile
+	// offset zigzag encoded and the action in its lowest two bits.
+	if (log->full)
+	{
+		return false;
+	}
+
+	int tile = input->row * log->cols + input->col;
+	long long offset = tile - log->lastTile;
+	unsigned long long zigzag = offset >= 0 ? (unsigned long long) offset << 1 : ((unsigned long long) -offset << 1) - 1;
+	int length = log->length;
+	bool fits = PutVarint(log, input->tick - log->lastTick) && PutVarint(log, zigzag << 2 | input->action);
+
+	if (fits && (log->inputs + 1) % log->checkEvery == 0)
+	{
+		unsigned hash = MinefieldHash(field);
+
+		for (int i = 0; i < 4 && fits; i++)
+		{
+			fits = PutByte(log, hash >> (8 * i));
+		}
+	}
+
+	if (!fits)
+	{
+		// Leave out the partial input, so what's there still applies.
+		log->length = length;
+		log->full = true;
+		return false;
+	}
+
+	log->lastTick = input->tick;
+	log->lastTile = tile;
+	log->inputs++;
+
+	return true;
+}
+
+void LockstepFollowerReset(struct LockstepFollower *follower, int cols, int checkEvery)
+{
+	memset(follower, 0, sizeof(*follower));
+	follower->cols = cols;
+	follower->checkEvery = checkEvery;
+}
+
+enum LockstepResult LockstepFollow(struct LockstepFollower *follower, struct Minefield *field, unsigned char byte)
+{
+	// A check's bytes come straight after the input that was due one.
+	if (follower->hashBytes > 0)
+	{
+		follower->hash |= (unsigned) byte << (8 * (4 - follower->hashBytes));
+
+		if (--follower->hashBytes > 0)
+		{
+			return LOCKSTEP_MORE;
+		}
+
+		return follower->hash == MinefieldHash(field) ? LOCKSTEP_IN_SYNC : LOCKSTEP_DESYNC;
+	}
+
+	// Ten bytes is all a 64 bit varint can take, so anything longer
+	// can't have come from LockstepAppend().
+	if (follower->shift >= 70)
+	{
+		return LOCKSTEP_DESYNC;
+	}
+
+	follower->value |= (unsigned long long) (byte & 0x7f) << follower->shift;
+	follower->shift += 7;
+
+	if (byte & 0x80)
+	{
+		return LOCKSTEP_MORE;
+	}
+
+	unsigned long long value = follower->value;
+
+	follower->value = 0;
+	follower->shift = 0;
+
+	// The first varint of an input is its tick, the second its tile.
+	if (!follower->haveTick)
+	{
+		follower->tick = follower->lastTick + value;
+		follower->haveTick = true;
+		return LOCKSTEP_MORE;
+	}
+
+	unsigned long long zigzag = value >> 2;
+	long long offset = zigzag & 1 ? -(long long) ((zigzag + 1) >> 1) : (long long) (zigzag >> 1);
+	long long tile = follower->lastTile + offset;
+
+	// An input off the board, or one that isn't an action, means the log
+	// has been garbled, and applying it would only make things worse.
+	if (tile < 0 || tile >= (long long) field->rows * field->cols || (value & 3) > LOCKSTEP_CHORD)
+	{
+		return LOCKSTEP_DESYNC;
+	}
+
+	follower->input.tick = follower->tick;
+	follower->input.action = value & 3;
+	follower->input.row = tile / follower->cols;
+	follower->input.col = tile % follower->cols;
+
+	follower->lastTick = follower->tick;
+	follower->lastTile = tile;
+	follower->haveTick = false;
+	follower->inputs++;
+
+	LockstepApply(field, &follower->input);
+
+	if (follower->inputs % follower->checkEvery == 0)
+	{
+		follower->hash = 0;
+		follower->hashBytes = 4;
+	}
+
+	return LOCKSTEP_APPLIED;
+}
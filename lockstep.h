@@ -0,0 +1,96 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - lockstep input logs
+
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdbool.h>
+
+#include "minefield.h"
+
+// A game sent as nothing but its inputs. Every end deals the board from
+// the same seed and applies the same inputs to it with the engine, which
+// is deterministic, so they all stay in the same state bit for bit.
+//
+// Each input is packed the way a replay packs a move: the tick it was
+// made on, relative to the input before, then what it was and how far
+// its tile is from the one before, both as varints. After every
+// checkEvery inputs comes MinefieldHash() of the game as it then stands,
+// as four bytes, low byte first. An end that has gone its own way finds
+// out at the next check, no more than checkEvery inputs on, and a whole
+// game usually comes to a few hundred bytes.
+#define LOCKSTEP_LENGTH 4096
+
+enum LockstepAction {
+	LOCKSTEP_REVEAL,
+	LOCKSTEP_FLAG,
+	LOCKSTEP_CHORD
+};
+
+// tick is whatever clock the game runs on, and never goes backwards.
+struct LockstepInput {
+	long long tick;
+	enum LockstepAction action;
+	int row;
+	int col;
+};
+
+struct LockstepLog {
+	unsigned seed;
+	int rows;
+	int cols;
+	int mines;
+	int checkEvery;
+	int inputs;
+	int length;
+	bool full;
+	long long lastTick;
+	int lastTile;
+	unsigned char data[LOCKSTEP_LENGTH];
+};
+
+// Applies a log a byte at a time, so it can be fed straight from the
+// socket. input is the last input applied.
+struct LockstepFollower {
+	int cols;
+	int checkEvery;
+	int inputs;
+	long long lastTick;
+	int lastTile;
+	unsigned long long value;
+	int shift;
+	bool haveTick;
+	long long tick;
+	int hashBytes;
+	unsigned hash;
+	struct LockstepInput input;
+};
+
+enum LockstepResult {
+	// The byte was part of an input or a check still to finish.
+	LOCKSTEP_MORE,
+	LOCKSTEP_APPLIED,
+	LOCKSTEP_IN_SYNC,
+	LOCKSTEP_DESYNC
+};
+
+// Apply an input to a game, the same way at every end. Returns how many
+// tiles it uncovered or flagged.
+int LockstepApply(struct Minefield *field, const struct LockstepInput *input);
+
+void LockstepReset(struct LockstepLog *log, unsigned seed, int rows, int cols, int mines, int checkEvery);
+// Add an input that has just been applied to field, along with a check
+// of field if one is due. Returns false, and marks the log full, once
+// it doesn't fit.
+bool LockstepAppend(struct LockstepLog *log, const struct Minefield *field, const struct LockstepInput *input);
+
+void LockstepFollowerReset(struct LockstepFollower *follower, int cols, int checkEvery);
+// Take the next byte of a log, applying each input to field as it
+// completes and checking field against each hash. A log that can't be
+// decoded, with a varint too long or an input off the board, is a
+// desync too.
+enum LockstepResult LockstepFollow(struct LockstepFollower *follower, struct Minefield *field, unsigned char byte);
+
+#endif
@@ -0,0 +1,462 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - game engine
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "minefield.h"
+
+static struct Tile *TileAt(const struct Minefield *field, int row, int col)
+{
+	return &field->tiles[row * field->cols + col];
+}
+
+static bool InBounds(const struct Minefield *field, int row, int col)
+{
+	return row >= 0 && row < field->rows && col >= 0 && col < field->cols;
+}
+
+static void Touch(struct Minefield *field, int index)
+{
+	// Remember a tile that's about to stop being blank, the first time.
+	struct Tile *tile = &field->tiles[index];
+
+	if (field->touched != NULL && !tile->isTouched)
+	{
+		tile->isTouched = true;
+		field->touched[field->touchedCount++] = index;
+	}
+}
+
+static void Changed(struct Minefield *field, int row, int col)
+{
+	Touch(field, row * field->cols + col);
+
+	if (field->changes != NULL)
+	{
+		field->changes[field->changeCount++] = row * field->cols + col;
+	}
+}
+
+void MinefieldInit(struct Minefield *field, int rows, int cols, struct Tile *tiles, int *work)
+{
+	memset(field, 0, sizeof(*field));
+
+	field->rows = rows;
+	field->cols = cols;
+	field->tiles = tiles;
+	field->work = work;
+
+	memset(tiles, 0, (size_t) rows * cols * sizeof(*tiles));
+}
+
+bool MinefieldReset(struct Minefield *field, int mines, unsigned seed)
+{
+	int count = field->rows * field->cols;
+
+	if (mines < 0 || mines >= count)
+	{
+		return false;
+	}
+
+	field->mines = mines;
+	field->seed = seed;
+	field->flags = 0;
+	field->minesFlagged = 0;
+	field->won = false;
+	field->lost = false;
+	field->changeCount = 0;
+
+	// Blank the last board. Only the tiles it touched need it, if it
+	// kept track of them.
+	if (field->touched != NULL)
+	{
+		for (int i = 0; i < field->touchedCount; i++)
+		{
+			memset(&field->tiles[field->touched[i]], 0, sizeof(*field->tiles));
+		}
+
+		field->touchedCount = 0;
+	}
+	else
+	{
+		memset(field->tiles, 0, (size_t) count * sizeof(*field->tiles));
+	}
+
+	// Randomly place the mines, dealt from the seed so that a replay
+	// gets the same board. The generator's state is kept here rather
+	// than in the C library, so boards on other threads don't disturb
+	// it; it gives the same numbers as srand() and rand() did for
+	// boards already saved.
+	struct random_data random;
+	char randomState[128];
+	int32_t value;
+
+	memset(&random, 0, sizeof(random));
+	initstate_r(seed, randomState, sizeof(randomState), &random);
+
+	for (int i = 0; i < mines; i++)
+	{
+		random_r(&random, &value);
+		int mineRow = value % field->rows;
+		random_r(&random, &value);
+		int mineCol = value % field->cols;
+
+		if (TileAt(field, mineRow, mineCol)->isMine)
+		{
+			i--;
+		}
+		else
+		{
+			Touch(field, mineRow * field->cols + mineCol);
+			TileAt(field, mineRow, mineCol)->isMine = true;
+			field->work[i] = mineRow * field->cols + mineCol;
+		}
+	}
+
+	// Count each mine on the tiles around it that aren't mines
+	// themselves, which only goes near the mines rather than over the
+	// whole board.
+	for (int i = 0; i < mines; i++)
+	{
+		int row = field->work[i] / field->cols;
+		int col = field->work[i] % field->cols;
+
+		for (int di = -1; di <= 1; di++)
+		{
+			for (int dj = -1; dj <= 1; dj++)
+			{
+				if ((di != 0 || dj != 0) && InBounds(field, row + di, col + dj) &&
+					!TileAt(field, row + di, col + dj)->isMine)
+				{
+					Touch(field, (row + di) * field->cols + col + dj);
+					TileAt(field, row + di, col + dj)->adjacentMines++;
+				}
+			}
+		}
+	}
+
+	return true;
+}
+
+static int FloodNeighbours(struct Minefield *field, int row, int col, int *top)
+{
+	// Uncover everything around an empty tile that isn't a mine, and
+	// queue up any of them that are empty too. A tile is only queued
+	// the once, when it's uncovered, so the work stack never overflows.
+	int uncovered = 0;
+
+	for (int di = -1; di <= 1; di++)
+	{
+		for (int dj = -1; dj <= 1; dj++)
+		{
+			int ni = row + di;
+			int nj = col + dj;
+
+			if ((di == 0 && dj == 0) || !InBounds(field, ni, nj))
+			{
+				continue;
+			}
+
+			struct Tile *tile = TileAt(field, ni, nj);
+
+			if (!tile->isMine && !tile->isFloodFillMarked)
+			{
+				tile->isFloodFillMarked = true;
+				Changed(field, ni, nj);
+				uncovered++;
+
+				if (tile->adjacentMines == 0)
+				{
+					field->work[(*top)++] = ni * field->cols + nj;
+				}
+			}
+		}
+	}
+
+	return uncovered;
+}
+
+int MinefieldReveal(struct Minefield *field, int row, int col)
+{
+	if (!InBounds(field, row, col))
+	{
+		return 0;
+	}
+
+	struct Tile *tile = TileAt(field, row, col);
+	int uncovered = 0;
+
+	// Uncover the tile if it isn't flagged.
+	if (!tile->isFlagged && !tile->isFloodFillMarked)
+	{
+		tile->isFloodFillMarked = true;
+		Changed(field, row, col);
+		uncovered++;
+	}
+
+	// If it's an empty non-mine tile, open up everything around it,
+	// and around every empty tile that uncovers, and so on.
+	if (tile->adjacentMines == 0 && !tile->isMine)
+	{
+		int top = 0;
+
+		uncovered += FloodNeighbours(field, row, col, &top);
+
+		while (top > 0)
+		{
+			int index = field->work[--top];
+			uncovered += FloodNeighbours(field, index / field->cols, index % field->cols, &top);
+		}
+	}
+
+	// Uncovering a mine loses the game straight away.
+	if (tile->isMine && tile->isFloodFillMarked)
+	{
+		field->lost = true;
+	}
+
+	return uncovered;
+}
+
+int MinefieldFlag(struct Minefield *field, int row, int col)
+{
+	// Either flag or unflag a tile that's still covered.
+	if (!InBounds(field, row, col) || TileAt(field, row, col)->isFloodFillMarked)
+	{
+		return 0;
+	}
+
+	struct Tile *tile = TileAt(field, row, col);
+
+	tile->isFlagged = !tile->isFlagged;
+	field->flags += tile->isFlagged ? 1 : -1;
+	Changed(field, row, col);
+
+	if (tile->isMine)
+	{
+		field->minesFlagged += tile->isFlagged ? 1 : -1;
+	}
+
+	if (field->minesFlagged == field->mines)
+	{
+		field->won = true;
+	}
+
+	return 1;
+}
+
+bool MinefieldCanChord(const struct Minefield *field, int row, int col)
+{
+	if (!InBounds(field, row, col))
+	{
+		return false;
+	}
+
+	const struct Tile *tile = TileAt(field, row, col);
+	int flags = 0;
+	int covered = 0;
+
+	if (!tile->isFloodFillMarked || tile->isMine || tile->adjacentMines == 0)
+	{
+		return false;
+	}
+
+	for (int di = -1; di <= 1; di++)
+	{
+		for (int dj = -1; dj <= 1; dj++)
+		{
+			if ((di != 0 || dj != 0) && InBounds(field, row + di, col + dj))
+			{
+				const struct Tile *neighbour = TileAt(field, row + di, col + dj);
+
+				if (neighbour->isFlagged)
+				{
+					flags++;
+				}
+				else if (!neighbour->isFloodFillMarked)
+				{
+					covered++;
+				}
+			}
+		}
+	}
+
+	return flags == tile->adjacentMines && covered > 0;
+}
+
+int MinefieldChord(struct Minefield *field, int row, int col)
+{
+	int uncovered = 0;
+
+	if (!MinefieldCanChord(field, row, col))
+	{
+		return 0;
+	}
+
+	for (int di = -1; di <= 1; di++)
+	{
+		for (int dj = -1; dj <= 1; dj++)
+		{
+			int ni = row + di;
+			int nj = col + dj;
+
+			if ((di != 0 || dj != 0) && InBounds(field, ni, nj) && !TileAt(field, ni, nj)->isFlagged &&
+				!TileAt(field, ni, nj)->isFloodFillMarked)
+			{
+				uncovered += MinefieldReveal(field, ni, nj);
+			}
+		}
+	}
+
+	return uncovered;
+}
+
+void MinefieldTrackChanges(struct Minefield *field, int *changes)
+{
+	field->changes = changes;
+	field->changeCount = 0;
+}
+
+void MinefieldKeepTouched(struct Minefield *field, int *touched)
+{
+	field->touched = touched;
+	field->touchedCount = 0;
+}
+
+const struct Tile *MinefieldTile(const struct Minefield *field, int row, int col)
+{
+	return TileAt(field, row, col);
+}
+
+char MinefieldTileCharacter(const struct Tile *tile)
+{
+	if (tile->isFloodFillMarked)
+	{
+		return tile->isMine ? 'X' : '0' + tile->adjacentMines;
+	}
+
+	return tile->isFlagged ? 'F' : '-';
+}
+
+static uint32_t HashInt(uint32_t hash, uint32_t value)
+{
+	// A byte at a time, low byte first, so every machine agrees.
+	for (int i = 0; i < 4; i++)
+	{
+		hash = (hash ^ ((value >> (8 * i)) & 0xff)) * 16777619u;
+	}
+
+	return hash;
+}
+
+unsigned MinefieldHash(const struct Minefield *field)
+{
+	// FNV-1a over the deal and everything play has changed since, and
+	// none of the engine's own bookkeeping, so two boards in the same
+	// state hash the same however they got there.
+	uint32_t hash = 2166136261u;
+	int count = field->rows * field->cols;
+
+	hash = HashInt(hash, field->rows);
+	hash = HashInt(hash, field->cols);
+	hash = HashInt(hash, field->mines);
+	hash = HashInt(hash, field->seed);
+	hash = HashInt(hash, field->flags);
+	hash = HashInt(hash, field->minesFlagged);
+	hash = HashInt(hash, field->won << 1 | field->lost);
+
+	for (int i = 0; i < count; i++)
+	{
+		const struct Tile *tile = &field->tiles[i];
+		unsigned char state = tile->isMine | tile->isFlagged << 1 | tile->isFloodFillMarked << 2 |
+							  tile->adjacentMines << 3;
+
+		hash = (hash ^ state) * 16777619u;
+	}
+
+	return hash;
+}
+
+static void Mark3BVRegion(struct Minefield *field, int row, int col)
+{
+	// Mark an opening the way revealing it would uncover it.
+	int top = 0;
+
+	Touch(field, row * field->cols + col);
+	TileAt(field, row, col)->is3BVMarked = true;
+	field->work[top++] = row * field->cols + col;
+
+	while (top > 0)
+	{
+		int index = field->work[--top];
+		int i = index / field->cols;
+		int j = index % field->cols;
+
+		for (int di = -1; di <= 1; di++)
+		{
+			for (int dj = -1; dj <= 1; dj++)
+			{
+				int ni = i + di;
+				int nj = j + dj;
+
+				if (!InBounds(field, ni, nj))
+				{
+					continue;
+				}
+
+				struct Tile *tile = TileAt(field, ni, nj);
+
+				if (!tile->isMine && !tile->is3BVMarked)
+				{
+					Touch(field, ni * field->cols + nj);
+					tile->is3BVMarked = true;
+
+					if (tile->adjacentMines == 0)
+					{
+						field->work[top++] = ni * field->cols + nj;
+					}
+				}
+			}
+		}
+	}
+}
+
+int Minefield3BV(struct Minefield *field)
+{
+	// The board's 3BV is the fewest clicks that could clear it: one
+	// for each opening (a connected region of empty tiles, along with
+	// the numbers around it), plus one for every number not on the
+	// edge of an opening.
+	int count = field->rows * field->cols;
+	int threeBV = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		field->tiles[i].is3BVMarked = false;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		struct Tile *tile = &field->tiles[i];
+
+		if (!tile->isMine && tile->adjacentMines == 0 && !tile->is3BVMarked)
+		{
+			threeBV++;
+			Mark3BVRegion(field, i / field->cols, i % field->cols);
+		}
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		if (!field->tiles[i].isMine && !field->tiles[i].is3BVMarked)
+		{
+			threeBV++;
+		}
+	}
+
+	return threeBV;
+}
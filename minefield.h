@@ -0,0 +1,89 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - game engine
+
+#ifndef MINEFIELD_H
+#define MINEFIELD_H
+
+#include <stdbool.h>
+
+// The rules of the game with nothing else attached: dealing a board from
+// a seed, revealing, flagging and chording tiles, telling when the game
+// is won or lost, and working out a board's 3BV. This is all that goes
+// into libminesweeper.
+//
+// The engine never allocates and keeps no state of its own. The caller
+// hands it a Minefield along with room for the tiles and a work stack,
+// each rows * cols long, and it only ever touches those, so any number
+// of boards can be played at once on any threads.
+
+struct Tile {
+	bool isMine;
+	bool isFlagged;
+	bool is3BVMarked;
+	bool isFloodFillMarked;
+	// On the touched list. See MinefieldKeepTouched().
+	bool isTouched;
+	int adjacentMines;
+};
+
+struct Minefield {
+	int rows;
+	int cols;
+	int mines;
+	unsigned seed;
+	int flags;
+	int minesFlagged;
+	bool won;
+	bool lost;
+	struct Tile *tiles;
+	int *work;
+	// Where tiles go as they change, if anywhere. See MinefieldTrackChanges().
+	int *changes;
+	int changeCount;
+	// Every tile that isn't blank any more, if kept.
+	int *touched;
+	int touchedCount;
+};
+
+void MinefieldInit(struct Minefield *field, int rows, int cols, struct Tile *tiles, int *work);
+// Deal a new board from seed. The same seed always deals the same board.
+// Returns false if the mines don't fit on the board.
+bool MinefieldReset(struct Minefield *field, int mines, unsigned seed);
+
+// Each returns how many tiles it uncovered or flagged. The game is lost
+// as soon as a mine is uncovered, and won once every mine is flagged.
+int MinefieldReveal(struct Minefield *field, int row, int col);
+int MinefieldFlag(struct Minefield *field, int row, int col);
+// Chording uncovers everything around a number with as many flags
+// around it as it says, and does nothing anywhere else.
+bool MinefieldCanChord(const struct Minefield *field, int row, int col);
+int MinefieldChord(struct Minefield *field, int row, int col);
+
+// Have every tile that's uncovered or flagged or unflagged from now on
+// added to changes (by its index, row * cols + col), for sending just
+// what a move did. A move changes at most rows * cols tiles, so changes
+// needs to be that long and emptied, by setting changeCount back to 0,
+// after each move. NULL stops tracking.
+void MinefieldTrackChanges(struct Minefield *field, int *changes);
+
+// Keep a list in touched (rows * cols long) of every tile the engine
+// has changed from blank, so that dealing the next board only clears
+// those tiles rather than the whole board. Call it straight after
+// MinefieldInit(), while every tile is still blank.
+void MinefieldKeepTouched(struct Minefield *field, int *touched);
+
+const struct Tile *MinefieldTile(const struct Minefield *field, int row, int col);
+// How a tile looks to the player: 0 to 8 once uncovered, X for an
+// uncovered mine, F for a flag and - for a covered tile.
+char MinefieldTileCharacter(const struct Tile *tile);
+// The fewest clicks that could clear the board.
+int Minefield3BV(struct Minefield *field);
+// A hash of everything about the game: the deal, every tile's state,
+// the flags and whether it's won or lost. The engine is deterministic,
+// so the same seed and the same moves always come to the same hash, on
+// any machine.
+unsigned MinefieldHash(const struct Minefield *field);
+
+#endif
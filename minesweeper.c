@@ -3,7 +3,11 @@
 // Term Project
 // Minesweeper
 
+// For posix_openpt() and ptsname().
+#define _GNU_SOURCE
+
 #include <time.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <curses.h>
@@ -11,149 +15,677 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <ncurses.h>
 #include <sqlite3.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <sys/ioctl.h>
 #include <sys/wait.h>
+#include <sys/un.h>
+#include <sys/socket.h>
 #include <sys/types.h>
 
+#include "ansi.h"
+#include "coop.h"
+#include "minefield.h"
+#include "race.h"
+#include "spectate.h"
+#include "gameserver.h"
+#include "lockstep.h"
+#include "stats.h"
+#include "scorestore.h"
+#include "scoreclient.h"
+
 void Usage();
-void NewGame();
-void PrintHud();
+struct GameContext;
+void InitializeGame(struct GameContext *game, int gameDifficulty);
+int DifficultyMines(int gameDifficulty);
+void DealBoard(struct GameContext *game);
+int PlayGame(struct GameContext *game);
+void PlaySession(struct GameContext *game);
+void HandleKey(struct GameContext *game, int key);
+void PrintHud(struct GameContext *game);
 void PrintGrid();
-void StartTimer();
-void PlaceBombs();
+void StartTimer(struct GameContext *game);
 void ViewScores();
-void PrintBoard();
-void InitializeGrid();
+void PrintBoard(struct GameContext *game);
+void DrawRanking(struct GameContext *game);
+void ReportRaceProgress(struct GameContext *game);
+void *RaceThread(void *arg);
+void PublishGame(struct GameContext *game);
+void WatchGame(const char *path);
+bool ApplyWatchLine(char *line);
+void DrawWatchedGame();
 void PrintWholeGrid();
-void Click(int i, int j);
 void InitializeMutexes();
+void LockScreen();
+bool TryLockScreen();
+void UnlockScreen();
+void DrawHud(struct GameContext *game);
+bool DrawDirtyHud(struct GameContext *game);
+void PrintStats(FILE *out);
+void WriteStats();
+void FrameCompleted(long long frameStart);
 void InitializeScreens();
+void ShutdownScreens();
+struct Panel;
+void PanelClear(struct Panel *panel);
+void PanelPrint(struct Panel *panel, int y, int x, const char *format, ...);
+void PanelMove(struct Panel *panel, int y, int x);
+void PanelRefresh(struct Panel *panel);
+void PanelGetString(struct Panel *panel, char *buffer, int size);
+int ReadKey();
+int SoakKey();
+void SoakCheckDeal(struct GameContext *game);
+void SoakSample();
+void SoakReport();
+long ResidentKilobytes();
+void SetKeyTimeout(int millis);
+long long TerminalBytesWritten();
+bool StartCountedTerminal(FILE **in, FILE **out);
+void *RelayTerminal(void *arg);
+void Relay(int from, int to, struct pollfd *watch, atomic_llong *counter);
+void StopCountedTerminal();
 void SIGTERMHandler(int sig);
-void FloodFill(int i, int j);
-void CalculateAdjacentBombs();
 void *TimerThread (void *args);
-void FloodFillRecurse(int i, int j);
-static int SQLTest(void *NotUsed, int argc, char **argv, char **azColName);
-static int ViewScoresSQL(void *NotUsed, int argc, char **argv, char **azColName);
-
-#define NAME_LENGTH 256
-
-int res;
-int score;
+void StartGameClock(struct GameContext *game);
+void SaveHighScore(struct GameContext *game);
+atomic_int *NextSaveStatus(struct GameContext *game);
+void StressTest(int writers);
+void ViewScoresRow(const char *scoreName, int rowScoreMs);
+void ViewStats();
+void ViewStatsRow(const struct GameStats *stats);
+void RecordGame(struct GameContext *game);
+void OpenScoresForViewing();
+bool NoScoresYet(int res);
+void ExportScores(const char *path);
+void ImportScores(const char *path);
+void RecordMove(struct GameContext *game, enum ReplayAction action, int row, int col);
+void ListReplays();
+void ListReplaysRow(const struct ReplayInfo *info, const char *replayName);
+void ViewReplay(int id);
+void ViewReplayMove(const struct ReplayMove *move);
+void BenchQueries(int count);
+struct SimulationTotals;
+void Simulate(int games);
+void RunSimulation(int games, int threads, struct SimulationTotals *totals);
+void *SimulationThread(void *arg);
+int PlaySimulatedGame(struct GameContext *game, unsigned moveSeed);
+int ChooseSimulatedMove(struct GameContext *game, unsigned *moveSeed);
+void Lockstep(int games, int checkEvery);
+int FollowLog(struct GameContext *peer, const struct LockstepLog *log, int divergeAfter, long long *checks);
+double TimeQueries(int count);
+void BenchQueriesRow(const char *rowName, int rowScoreMs);
+
+#define NAME_LENGTH SCORE_NAME_LENGTH
+#define HIGH_SCORE_PLACES 10
+#define STRESS_WINS 50
+#define SIMULATION_MAX_THREADS 64
+#define SOAK_SETTLED 1000
+#define SAVE_STATUS_SLOTS 8
+#define LOCKSTEP_CHECK_EVERY 8
+#define RACE_RANKING_ROWS 11
+
+#define GRID_ROWS 10
+#define GRID_COLS 10
+
+// The terminal, the timer process and the counters belong to the
+// process. Everything about a game is in its GameContext.
 pid_t pid;
-int boardX;
-int boardY;
-int seconds;
-int screenX;
-int screenY;
-sqlite3 *db;
-int initialX;
-int initialY;
-bool gameWon;
 int pipes[2];
-char sql[128];
-bool gameLost;
-int difficulty;
-int gridRows = 10;
-int gridCols = 10;
-int numberOfBombs;
+int viewDifficulty = -1;
+int terminalCols;
+int keyTimeout = 100;
 char readBuffer[6];
-int bombsRemaining;
 pthread_t a_thread;
-WINDOW *hud, *board;
 void *thread_result;
-char *zErrorMsg = 0;
 struct sigaction act;
-char name[NAME_LENGTH];
 bool sqlResults = false;
 bool timerStarted = false;
-int bombsCorrectlyFlagged;
+long long processStartNanos = 0;
+bool ansiRenderer = false;
+bool statsEnabled = false;
+char *statsPath = NULL;
 pthread_mutex_t screenMutex;
-pthread_mutex_t secondsMutex;
-pthread_mutex_t wonLostMutex;
 char writeBuffer[] = "second";
 
-struct Tile {
-	bool isMine;
-	bool isFlagged;
-	bool is3BVMarked;
-	bool isFloodFillMarked;
-	int adjacentMines;
+// A race plays the one board the coordinator deals, then quits.
+bool racing = false;
+struct RaceStart raceStart;
+pthread_t raceThread;
+const char *playAgainPrompt = "Press (r) to play again or (q) to quit";
+
+// What a -watch spectator knows of the game they're watching: the
+// last whole board they were sent, with every change since applied.
+char *watchedTiles = NULL;
+int watchedRows = 0;
+int watchedCols = 0;
+char watchedState = 'P';
+int watchedMinesLeft = 0;
+int watchedSeconds = 0;
+int watchedRow = 0;
+int watchedCol = 0;
+
+// Counters for screenMutex, used to show that nobody holds the screen
+// long enough to stall the input loop.
+struct LockStats {
+	long long acquisitions;
+	long long contended;
+	long long skipped;
+	long long waitNanos;
+	long long holdNanos;
+	long long maxHoldNanos;
+	long long lockedAt;
+};
+
+struct LockStats screenLockStats;
+
+// Time from a key being read to the frame showing its effect being
+// handed to the terminal, and how long each frame took to draw.
+struct Histogram inputLatency;
+struct Histogram renderTime;
+struct Histogram keysPerFrame;
+
+struct Histogram frameBytes;
+
+// From main() being entered to the first board being on screen, or to
+// the high scores being printed. Recorded once, for -stats.
+long long startupNanos = 0;
+
+// -soak plays these keys over and over in place of the keyboard: a
+// few flags, moves and a reveal, then a restart, until it has
+// restarted soakRestarts times. Each board it's dealt is checked
+// against the same board dealt from scratch.
+const int soakKeys[] = { 'f', KEY_RIGHT, 'f', 'f', KEY_DOWN, 10, 'c', KEY_LEFT, 'r' };
+int soakKey = 0;
+int soakRestarts = 0;
+int soakDone = 0;
+int soakMismatches = 0;
+long long soakStartNanos = 0;
+long soakSettledKilobytes = 0;
+long soakFinalKilobytes = 0;
+
+// When the oldest key not yet shown on screen was read, or 0 if
+// the screen is up to date.
+long long pendingKeyNanos = 0;
+
+// Bytes sent to the terminal as of the last completed frame, and the
+// running totals kept by the ANSI renderer and for ncurses.
+long long lastFrameBytes = 0;
+atomic_llong ansiBytes;
+atomic_llong cursesBytes;
+
+// With -stats, ncurses runs on a pseudo terminal of its own, and a
+// thread passes what it draws on to the real one, counting it, and
+// the keys typed at the real one back to it. See StartCountedTerminal().
+int countedMaster = -1;
+int countedSlave = -1;
+int countedStop[2] = { -1, -1 };
+struct termios countedSaved;
+pthread_t countedThread;
+bool countedRunning = false;
+
+// The HUD and the gameboard. With ncurses each one is a window; with
+// the ANSI renderer they are bands of rows in its screen buffer.
+struct Panel {
+	WINDOW *window;
+	int top;
+	int rows;
+};
+
+struct Panel hudPanel;
+struct Panel boardPanel;
+struct Panel *hud = &hudPanel;
+struct Panel *board = &boardPanel;
+
+const char *difficultyNames[] = { "Easy", "Normal", "Hard" };
+
+// Everything about one game. The game logic only ever touches the
+// context it's handed, so any number of games can be played at once,
+// one to a thread.
+struct GameContext {
+	// The board itself, played by the engine in the space kept here.
+	struct Minefield field;
+	struct Tile tiles[GRID_ROWS * GRID_COLS];
+	int work[GRID_ROWS * GRID_COLS];
+	int touched[GRID_ROWS * GRID_COLS];
+	// The tiles changed since spectators were last sent them.
+	int changes[GRID_ROWS * GRID_COLS];
+	int difficulty;
+	unsigned gameSeed;
+
+	// Where the cursor is, on the board and on the screen.
+	int boardX;
+	int boardY;
+	int screenX;
+	int screenY;
+	int initialX;
+	int initialY;
+
+	int clicks;
+	long long gameStartNanos;
+	long long gameMillis;
+	int score;
+	int scoreMs;
+	char name[NAME_LENGTH];
+
+	// Every reveal and flag made in the game, saved with its score.
+	// Nothing is recorded while a replay is being played back.
+	struct Replay replay;
+	bool replaying;
+
+	// State shared between the input loop and the timer thread. These are
+	// published as atomics so that neither side ever waits on the other to
+	// read them; only drawing to the screen still needs screenMutex.
+	atomic_int seconds;
+	atomic_bool gameWon;
+	atomic_bool gameLost;
+	atomic_int bombsRemaining;
+
+	// Set by the timer thread when it couldn't get the screen to redraw the
+	// HUD, so the next board redraw picks it up instead.
+	atomic_bool hudDirty;
+
+	// Set while the player is typing their name for the high scores, so
+	// the race thread leaves the screen alone until they're done.
+	atomic_bool askingName;
+
+	// Where the last winning score is in being written out. Each save
+	// gets a slot of its own that no earlier save is still writing to,
+	// so a late update from the last game's save can't show up as this
+	// one's.
+	atomic_int saveStatuses[SAVE_STATUS_SLOTS];
+	atomic_int *saveStatus;
 };
 
-struct Tile grid[10][10];
+// The game being played back by -replay, for its move callback.
+struct GameContext *replayGame;
+
+// What a batch of simulated games came to. Every game is dealt and
+// played from its own number, so the totals come out the same however
+// many threads play them.
+struct SimulationTotals {
+	long long games;
+	long long wins;
+	long long moves;
+	long long threeBV;
+};
+
+// One thread's share of a simulation. Threads take the next game
+// number from the shared counter until there are none left.
+struct SimulationWorker {
+	pthread_t thread;
+	atomic_int *nextGame;
+	int games;
+	struct SimulationTotals totals;
+};
 
 int main(int argc, char *argv[]) {
 
-	// Error check the inputs
-	if (argc > 2 || argc == 1)
+	processStartNanos = MonotonicNanos();
+
+	// Error check the inputs. Exactly one single letter mode flag
+	// is required, optionally alongside -stats.
+	char mode = '\0';
+	int stressWriters = 0;
+	char *exportPath = NULL;
+	char *importPath = NULL;
+	int replayId = 0;
+	int benchQueries = 0;
+	int simulateGames = 0;
+	char *serverPath = NULL;
+	char *loadPath = NULL;
+	int loadConnections = 0;
+	bool botProtocol = false;
+	char *racePath = NULL;
+	char *raceName = getenv("USER");
+	char *raceHostPath = NULL;
+	char *publishPath = NULL;
+	char *watchPath = NULL;
+	int raceHostPlayers = 0;
+	int botScriptGames = 0;
+	int coopBenchSide = 0;
+	int lockstepGames = 0;
+	int lockstepCheckEvery = LOCKSTEP_CHECK_EVERY;
+	bool listReplays = false;
+
+	for (int i = 1; i < argc; i++)
 	{
-		Usage();
+		if (strcmp(argv[i], "-renderer") == 0 && i + 1 < argc)
+		{
+			// Pick how the game is drawn. ncurses is the default.
+			i++;
+
+			if (strcmp(argv[i], "ansi") == 0)
+			{
+				ansiRenderer = true;
+			}
+			else if (strcmp(argv[i], "ncurses") != 0)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-stress") == 0 && i + 1 < argc)
+		{
+			stressWriters = atoi(argv[++i]);
+
+			if (stressWriters < 1)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-export") == 0 && i + 1 < argc)
+		{
+			exportPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "-import") == 0 && i + 1 < argc)
+		{
+			importPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "-bench-queries") == 0 && i + 1 < argc)
+		{
+			benchQueries = atoi(argv[++i]);
+
+			if (benchQueries < 1)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-simulate") == 0 && i + 1 < argc)
+		{
+			simulateGames = atoi(argv[++i]);
+
+			if (simulateGames < 1)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-server") == 0 && i + 1 < argc)
+		{
+			serverPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "-load") == 0 && i + 2 < argc)
+		{
+			loadPath = argv[++i];
+			loadConnections = atoi(argv[++i]);
+
+			if (loadConnections < 1)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-soak") == 0 && i + 1 < argc)
+		{
+			soakRestarts = atoi(argv[++i]);
+
+			if (soakRestarts < 1)
+			{
+				Usage();
+			}
+
+			soakStartNanos = MonotonicNanos();
+		}
+		else if (strcmp(argv[i], "-race") == 0 && i + 1 < argc)
+		{
+			racePath = argv[++i];
+
+			// An optional name to race under, instead of the login name.
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+			{
+				raceName = argv[++i];
+			}
+		}
+		else if (strcmp(argv[i], "-race-host") == 0 && i + 2 < argc)
+		{
+			raceHostPath = argv[++i];
+			raceHostPlayers = atoi(argv[++i]);
+
+			if (raceHostPlayers < 1 || raceHostPlayers > RACE_MAX_PLAYERS)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-publish") == 0 && i + 1 < argc)
+		{
+			publishPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "-watch") == 0 && i + 1 < argc)
+		{
+			watchPath = argv[++i];
+		}
+		else if (strcmp(argv[i], "-bot-protocol") == 0)
+		{
+			botProtocol = true;
+		}
+		else if (strcmp(argv[i], "-bot-script") == 0 && i + 1 < argc)
+		{
+			botScriptGames = atoi(argv[++i]);
+
+			if (botScriptGames < 1)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-coop-bench") == 0 && i + 1 < argc)
+		{
+			coopBenchSide = atoi(argv[++i]);
+
+			if (coopBenchSide < 1)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-lockstep") == 0 && i + 1 < argc)
+		{
+			lockstepGames = atoi(argv[++i]);
+
+			// An optional number of moves between state checks.
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+			{
+				lockstepCheckEvery = atoi(argv[++i]);
+			}
+
+			if (lockstepGames < 1 || lockstepCheckEvery < 1)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-replays") == 0)
+		{
+			listReplays = true;
+		}
+		else if (strcmp(argv[i], "-replay") == 0 && i + 1 < argc)
+		{
+			replayId = atoi(argv[++i]);
+
+			if (replayId < 1)
+			{
+				Usage();
+			}
+		}
+		else if (strcmp(argv[i], "-stats") == 0)
+		{
+			statsEnabled = true;
+
+			// An optional file name sends the stats there instead of stderr.
+			if (i + 1 < argc && argv[i + 1][0] != '-')
+			{
+				statsPath = argv[++i];
+			}
+		}
+		else if (strlen(argv[i]) == 2 && argv[i][0] == '-' && mode == '\0')
+		{
+			mode = argv[i][1];
+
+			// -s can be followed by e, n or h to show just that table.
+			if (mode == 's' && i + 1 < argc && argv[i + 1][0] != '-')
+			{
+				const char *letters = "enh";
+				const char *letter = strchr(letters, argv[++i][0]);
+
+				if (letter == NULL || argv[i][0] == '\0' || argv[i][1] != '\0')
+				{
+					Usage();
+				}
+
+				viewDifficulty = letter - letters;
+			}
+		}
+		else
+		{
+			Usage();
+		}
 	}
 
-	if (strlen(argv[1]) != 2 || argv[1][0] != '-')
+	if (stressWriters > 0)
 	{
-		Usage();
+		StressTest(stressWriters);
+		exit(0);
 	}
 
-	// Check if database exists.
-	if (access("scores.db", F_OK) != -1)
+	if (exportPath != NULL)
 	{
-		res = sqlite3_open("scores.db", &db);
+		ExportScores(exportPath);
+		WriteStats();
+		exit(0);
+	}
 
-		if (res)
-		{
-			fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-			sqlite3_close(db);
-			exit(EXIT_FAILURE);
-		}
+	if (importPath != NULL)
+	{
+		ImportScores(importPath);
+		WriteStats();
+		exit(0);
 	}
-	else
+
+	if (serverPath != NULL)
 	{
-		// If not, initialize it.
-		res = sqlite3_open("scores.db", &db);
+		GameServerRun(serverPath);
+		exit(0);
+	}
 
-		if (res)
-		{
-			fprintf(stderr, "Can't open database: %s\n", sqlite3_errmsg(db));
-			sqlite3_close(db);
-			exit(EXIT_FAILURE);
-		}
-		// Create the scores schema
-		strcpy(sql, "create table scores("  \
-						  "id integer primary key autoincrement unique,"
-                          "name varchar(30)," \
-                          "score int);");
+	if (loadPath != NULL)
+	{
+		GameServerLoad(loadPath, loadConnections);
+		exit(0);
+	}
 
-        res = sqlite3_exec(db, sql, NULL, 0, &zErrorMsg);
+	if (watchPath != NULL)
+	{
+		WatchGame(watchPath);
+		WriteStats();
+		exit(0);
+	}
 
-		if (res != SQLITE_OK)
+	if (botProtocol)
+	{
+		GameServerBot();
+		exit(0);
+	}
+
+	if (botScriptGames > 0)
+	{
+		GameServerScript(botScriptGames);
+		exit(0);
+	}
+
+	if (simulateGames > 0)
+	{
+		Simulate(simulateGames);
+		exit(0);
+	}
+
+	if (lockstepGames > 0)
+	{
+		Lockstep(lockstepGames, lockstepCheckEvery);
+		exit(0);
+	}
+
+	if (coopBenchSide > 0)
+	{
+		CoopBenchmark(coopBenchSide);
+		exit(0);
+	}
+
+	if (benchQueries > 0)
+	{
+		BenchQueries(benchQueries);
+		WriteStats();
+		exit(0);
+	}
+
+	if (listReplays)
+	{
+		ListReplays();
+		WriteStats();
+		exit(0);
+	}
+
+	if (replayId > 0)
+	{
+		ViewReplay(replayId);
+		WriteStats();
+		exit(0);
+	}
+
+	if (racePath != NULL)
+	{
+		// The coordinator picks the difficulty and deals the board.
+		printf("Waiting for the race on %s to start\n", racePath);
+		fflush(stdout);
+
+		if (!RaceJoin(racePath, raceName != NULL ? raceName : "player", &raceStart) ||
+			raceStart.difficulty < 0 || raceStart.difficulty > 2)
 		{
-			fprintf(stderr, "SQL error3: %s\n", zErrorMsg);
-			sqlite3_free(zErrorMsg);
+			fprintf(stderr, "There's no race on %s\n", racePath);
 			exit(EXIT_FAILURE);
 		}
+
+		racing = true;
+		mode = "enh"[raceStart.difficulty];
+		playAgainPrompt = "Press (q) to quit";
+	}
+
+	if (mode == '\0')
+	{
+		Usage();
 	}
 
-	// Set difficulty based on user flag.
-	switch(argv[1][1])
+	// Set difficulty based on user flag. The score screens only read the
+	// high score database, so it's opened read only for them.
+	int gameDifficulty = 0;
+
+	switch(mode)
 	{
 		case 'e':
-			difficulty = 0;
+			gameDifficulty = 0;
 			break;
 
 		case 'n':
-			difficulty = 1;
+			gameDifficulty = 1;
 			break;
 
 		case 'h':
-			difficulty = 2;
+			gameDifficulty = 2;
 			break;
 
 		case 's':
+			OpenScoresForViewing();
 			ViewScores();
+			startupNanos = MonotonicNanos() - processStartNanos;
+			ScoreStoreClose();
+			WriteStats();
+			exit(0);
+			break;
+
+		case 'S':
+			OpenScoresForViewing();
+			ViewStats();
+			startupNanos = MonotonicNanos() - processStartNanos;
+			ScoreStoreClose();
+			WriteStats();
 			exit(0);
 			break;
 
@@ -161,88 +693,193 @@ int main(int argc, char *argv[]) {
 			Usage();
 	}
 
+	if (raceHostPath != NULL)
+	{
+		RaceHost(raceHostPath, raceHostPlayers, gameDifficulty,
+				 GRID_ROWS * GRID_COLS - DifficultyMines(gameDifficulty));
+		exit(0);
+	}
+
+	// A game doesn't need the high score database until it's over, so
+	// open it (creating it and its schema the first time) in the
+	// background rather than keep the player waiting on it. If that
+	// fails, saving a score says so on the win screen. High scores go
+	// through minesweeperd instead when it's running.
+	ScoreStoreUseDaemon(SCORE_DAEMON_SOCKET);
+	ScoreStoreOpenAsync("scores.db");
+
+	struct GameContext game;
+
+	InitializeGame(&game, gameDifficulty);
+
+	// Spectators are sent each move's changed tiles as it's made.
+	if (publishPath != NULL)
+	{
+		if (!SpectateOpen(publishPath))
+		{
+			fprintf(stderr, "Can't take spectators on %s\n", publishPath);
+			exit(EXIT_FAILURE);
+		}
+
+		MinefieldTrackChanges(&game.field, game.changes);
+	}
+
 	InitializeMutexes();
 
 	InitializeScreens();
 
-	StartTimer();
+	StartTimer(&game);
+
+	if (racing && pthread_create(&raceThread, NULL, RaceThread, &game) != 0)
+	{
+		perror("thread creation failed");
+		exit(EXIT_FAILURE);
+	}
+
+	PlaySession(&game);
 
-	NewGame();
+	if (racing)
+	{
+		RaceLeave();
+		pthread_join(raceThread, NULL);
+		RaceClose();
+	}
 
-	// After returning from the recursive NewGame() call,
-	// start shutting down the program.
+	SpectateClose(stderr);
+
+	// Once the user quits, start shutting down the program.
 
 	// Kill the timer process and wait for it to finish.
 	kill(pid, SIGTERM);
 	waitpid(pid, (int*) 0, 0);
 
 	// Wait for the timer update thread to stop.
-	res = pthread_join(a_thread, &thread_result);
-	if (res != 0) {
+	if (pthread_join(a_thread, &thread_result) != 0) {
 		perror("Thread join failed");
 		exit(EXIT_FAILURE);
 	}
 
 	// Restore console settings.
-	echo();
-	nocbreak();
-	endwin();
+	ShutdownScreens();
 
 	// Close the database.
-	sqlite3_close(db);
-	exit(0);
+	ScoreStoreClose();
+
+	if (soakRestarts > 0)
+	{
+		SoakReport();
+	}
+
+	WriteStats();
+
+	exit(soakMismatches > 0 ? EXIT_FAILURE : 0);
+}
+
+void InitializeGame(struct GameContext *game, int gameDifficulty)
+{
+	// Start a context off empty, for a board of the usual size.
+	memset(game, 0, sizeof(*game));
+
+	MinefieldInit(&game->field, GRID_ROWS, GRID_COLS, game->tiles, game->work);
+	MinefieldKeepTouched(&game->field, game->touched);
+	game->difficulty = gameDifficulty;
 }
 
-void NewGame()
+int DifficultyMines(int gameDifficulty)
 {
-	// Set the bomb count based on difficulty.
-	switch(difficulty)
+	// The bomb count for each difficulty.
+	switch(gameDifficulty)
 	{
 		case 0:
-			numberOfBombs = 5;
-			break;
+			return 5;
 
 		case 1:
-			numberOfBombs = 15;
-			break;
+			return 15;
 
 		case 2:
-			numberOfBombs = 25;
-			break;
+			return 25;
 	}
 
-	InitializeGrid();
-	PlaceBombs();
-	CalculateAdjacentBombs();
+	return 0;
+}
 
-	// Set the initial bombs remaining number.
-	bombsRemaining = numberOfBombs;
+void DealBoard(struct GameContext *game)
+{
+	// Deal a board from the context's seed and reset everything
+	// else about the game to go with it.
+	int numberOfBombs = DifficultyMines(game->difficulty);
 
-	// Set the initial starting point of the board on screen.
-	initialY = 1;
-    initialX = (COLS / 2) - gridCols;
+	MinefieldReset(&game->field, numberOfBombs, game->gameSeed);
+
+	ReplayReset(&game->replay, game->gameSeed, numberOfBombs, game->field.cols);
+
+	// Set the initial bombs remaining number.
+	game->bombsRemaining = numberOfBombs;
 
 	// Copies of the starting point for moving around.
-    screenY = initialY;
-    screenX = initialX;
+    game->screenY = game->initialY;
+    game->screenX = game->initialX;
 
 	// Location on the board that the cursor is hovering over.
-    boardY = 0;
-    boardX = 0;
+    game->boardY = 0;
+    game->boardX = 0;
+
+    game->gameLost = false;
+    game->gameWon = false;
+
+	// Zero out the seconds counter
+	game->seconds = 0;
+
+	// Nothing has been clicked or flagged yet.
+	game->clicks = 0;
+
+	// The game clock doesn't start until the first move.
+	game->gameStartNanos = 0;
+	game->gameMillis = 0;
+}
+
+void PlaySession(struct GameContext *game)
+{
+	// Play game after game in the one context, with the same windows,
+	// timer and replay buffer, until the user quits. Dealing the next
+	// board only clears the tiles the last one touched, so a session
+	// can go on for any number of games in the same memory.
+	while (PlayGame(game) == 'r' && !racing)
+	{
+		SetKeyTimeout(100);
+	}
+}
+
+int PlayGame(struct GameContext *game)
+{
+	// Play one game, and return the key the user left it with.
 
-    gameLost = false;
-    gameWon = false;
+	// Set the initial starting point of the board on screen.
+	game->initialY = 1;
+	game->initialX = (terminalCols / 2) - game->field.cols;
+
+	// Deal a new board. The seed is kept with the game's history and
+	// its replay so the same board can be dealt again.
+	game->gameSeed = (unsigned)time(NULL) ^ (unsigned)MonotonicNanos() ^ ((unsigned)getpid() << 16);
+
+	// A race deals everyone the coordinator's board.
+	if (racing)
+	{
+		game->gameSeed = raceStart.seed;
+	}
+
+	DealBoard(game);
 
-	// Zero out the correct flag count.
-    bombsCorrectlyFlagged = 0;
+	if (soakRestarts > 0)
+	{
+		SoakCheckDeal(game);
+	}
 
-	// Mutex and zero out the seconds counter
-	pthread_mutex_lock(&secondsMutex);
-	seconds = 0;
-	pthread_mutex_unlock(&secondsMutex);
+	SpectateResync();
+	PublishGame(game);
 
-	PrintHud();
-	PrintBoard();
+	PrintHud(game);
+	PrintBoard(game);
 
 	int key;
 
@@ -250,167 +887,285 @@ void NewGame()
 	{
 		// This is the main event loop. It continually gets user input while
 		// the game is running in a non blocking fashion.
-		key = getch();
+		key = ReadKey();
 
-		// Respond to user arrow and keyboard inputs.
-		if (key == KEY_LEFT && boardX > 0)
+		// Stamp the key so the frame that shows it can be timed.
+		if (key != ERR && pendingKeyNanos == 0)
 		{
-			boardX--;
-			screenX -= 2;
+			pendingKeyNanos = MonotonicNanos();
 		}
 
-		if (key == KEY_RIGHT && boardX < gridCols - 1)
-		{
-			boardX++;
-			screenX += 2;
-		}
+		// Apply every key that is already queued before drawing, so held
+		// down keys don't leave the cursor lagging behind a backlog of
+		// frames. Stop early on anything that ends the game.
+		int keysThisFrame = 0;
 
-		if (key == KEY_UP && boardY > 0)
+		while (key != ERR)
 		{
-			boardY--;
-			screenY--;
+			HandleKey(game, key);
+			PublishGame(game);
+			keysThisFrame++;
+
+			if (key == 'q' || key == 'r' || game->gameLost || game->gameWon)
+			{
+				break;
+			}
+
+			SetKeyTimeout(0);
+			int nextKey = ReadKey();
+			SetKeyTimeout(100);
+
+			if (nextKey == ERR)
+			{
+				break;
+			}
+
+			key = nextKey;
 		}
 
-		if (key == KEY_DOWN && boardY < gridRows - 1)
+		if (keysThisFrame > 0)
 		{
-			boardY++;
-			screenY++;
+			HistogramRecord(&keysPerFrame, keysThisFrame);
 		}
 
-		if (key == 10)
+		// Refresh the board on every user event.
+		PrintBoard(game);
+
+		if (racing)
 		{
-			// When the user presses enter over a space on the grid,
-			// execute the click function for that space.
-			Click(boardY, boardX);
+			ReportRaceProgress(game);
 		}
 
-		if (key == 'f')
-		{
-			// Either flag or unflag the current space.
-			if (!grid[boardY][boardX].isFloodFillMarked)
-			{
-				if (!grid[boardY][boardX].isFlagged)
-				{
-					grid[boardY][boardX].isFlagged = true;
-					bombsRemaining--;
+		// Keep the spectators' clock going between moves.
+		PublishGame(game);
 
-					if (grid[boardY][boardX].isMine)
-					{
-						bombsCorrectlyFlagged++;
-					}
-				}
-				else
-				{
-					grid[boardY][boardX].isFlagged = false;
+		// And repeat until the user quits, restarts, wins, or loses the game.
+	} while (key != 'q' && key != 'r' && !game->gameLost && !game->gameWon);
 
-					if (grid[boardY][boardX].isMine)
-					{
-						bombsCorrectlyFlagged--;
-					}
-					bombsRemaining++;
-				}
+	// Sample the monotonic clock for how long a finished game took,
+	// and add it to the history whether it was won or lost. Scripted
+	// -soak games aren't anyone's, so they're left out.
+	if (game->gameWon || game->gameLost)
+	{
+		game->gameMillis = (MonotonicNanos() - game->gameStartNanos) / 1000000;
 
-				if (bombsCorrectlyFlagged == numberOfBombs)
-				{
-					pthread_mutex_lock(&wonLostMutex);
-					gameWon = true;
-					pthread_mutex_unlock(&wonLostMutex);
-				}
-			}
+		if (soakRestarts == 0)
+		{
+			RecordGame(game);
 		}
-
-		// Refresh the board on every user event.
-		PrintBoard();
-
-		// And repeat until the user quits, restarts, wins, or loses the game.
-	} while (key != 'q' && key != 'r' && !gameLost && !gameWon);
+	}
 
 	// Once outside of the event loop, check to see whether the user won or lost.
-	pthread_mutex_lock(&wonLostMutex);
-	if (gameWon)
+	// Nothing is locked while waiting on the user here, so the timer thread
+	// keeps running freely.
+	if (game->gameWon)
 	{
-		// Grab the seconds mutex and pull it to another variable.
-		int gameSeconds;
-		pthread_mutex_lock(&secondsMutex);
-		gameSeconds = seconds;
-		pthread_mutex_unlock(&secondsMutex);
+		// The integer score keeps its whole-second meaning for compatibility,
+		// while scoreMs carries the same score with millisecond precision.
+		int gameSeconds = game->gameMillis / 1000;
+		int maxScore = 0;
 
 		// Compute the score based on the time and difficulty.
-		switch(difficulty)
+		switch(game->difficulty)
 		{
 			case 0:
-				score = 250 - gameSeconds;
+				maxScore = 250;
 				break;
 
 			case 1:
-				score = 500 - gameSeconds;
+				maxScore = 500;
 				break;
 
 			case 2:
-				score = 1000 - gameSeconds;
+				maxScore = 1000;
 				break;
 		}
 
-		// Tell the user they won and show them their score.
-		wclear(hud);
-		wclear(board);
+		game->score = maxScore - gameSeconds;
+		game->scoreMs = maxScore * 1000 - game->gameMillis;
 
-		mvwprintw(board, 1, (COLS / 2) - 10, "%s", "You Won!");
-		mvwprintw(board, 3, (COLS / 2) - 10, "Your score was %d", score);
+		// Tell the user they won and show them their score. The screen is
+		// taken so a HUD draw the timer already started can't land on top.
+		LockScreen();
+		PanelClear(hud);
+		PanelClear(board);
 
-		wrefresh(hud);
-		wrefresh(board);
+		PanelPrint(board, 1, (terminalCols / 2) - 10, "%s", "You Won!");
+		PanelPrint(board, 3, (terminalCols / 2) - 10, "Your score was %.3f", game->scoreMs / 1000.0);
 
-		// Check whether the score is high enough to be saved.
-		strcpy(sql, "select count(score), id, min(score) from scores");
+		PanelRefresh(hud);
+		PanelRefresh(board);
+		UnlockScreen();
 
-		res = sqlite3_exec(db, sql, SQLTest, 0, &zErrorMsg);
-		sleep(2);
+		// Check whether the score is high enough to be saved. If it is,
+		// it's written in the background while the user decides what's next.
+		game->saveStatus = NextSaveStatus(game);
+		SaveHighScore(game);
 
-		// Ask the user if they want to play again.
-		wclear(board);
-		mvwprintw(board, 5, (COLS / 2) - 19, "%s", "Press (r) to play again or (q) to quit");
-		wrefresh(board);
+		// Ask the user if they want to play again, redrawing whenever the
+		// save progresses. Give up after 100 seconds like before.
+		long long promptStart = MonotonicNanos();
+		int shownStatus = -1;
+
+		SetKeyTimeout(100);
+		key = ERR;
+
+		while (key != 'r' && key != 'q' && MonotonicNanos() - promptStart < 100000000000LL)
+		{
+			if (*game->saveStatus != shownStatus)
+			{
+				shownStatus = *game->saveStatus;
+
+				// The race thread draws the ranking too.
+				LockScreen();
+				PanelClear(board);
+				PanelPrint(board, 1, (terminalCols / 2) - 10, "%s", "You Won!");
+				PanelPrint(board, 3, (terminalCols / 2) - 10, "Your score was %.3f", game->scoreMs / 1000.0);
+
+				if (shownStatus == SCORE_SAVING)
+				{
+					PanelPrint(board, 5, (terminalCols / 2) - 10, "%s", "Saving your score...");
+				}
+				else if (shownStatus == SCORE_SAVED)
+				{
+					PanelPrint(board, 5, (terminalCols / 2) - 10, "%s", "Your score has been saved");
+				}
+				else if (shownStatus == SCORE_FAILED)
+				{
+					PanelPrint(board, 5, (terminalCols / 2) - 10, "%s", "Your score couldn't be saved");
+				}
+
+				PanelPrint(board, 7, (terminalCols / 2) - 19, "%s", playAgainPrompt);
+
+				if (racing)
+				{
+					DrawRanking(game);
+				}
+
+				PanelRefresh(board);
+				UnlockScreen();
+			}
 
-		timeout(100000);
-		key = getch();
+			key = ReadKey();
+		}
 	}
 
-	if (gameLost)
+	if (game->gameLost)
 	{
-		// Wait for 3/4 second to show the user the mine they hit.
-		usleep(750000);
+		// Wait for 3/4 second to show the user the mine they hit, unless
+		// it's a -soak script that hit it.
+		if (soakRestarts == 0)
+		{
+			usleep(750000);
+		}
 
 
-		timeout(100000);
+		SetKeyTimeout(100000);
 		// Ask the user if they want to play again.
 		while (key != 'r' && key != 'q')
 		{
-			wclear(hud);
-			wclear(board);
+			LockScreen();
+			PanelClear(hud);
+			PanelClear(board);
 
-			mvwprintw(board, 1, (COLS / 2) - 5, "%s", "Game Over");
-			mvwprintw(board, 3, (COLS / 2) - 19, "%s", "Press (r) to play again or (q) to quit");
+			PanelPrint(board, 1, (terminalCols / 2) - 5, "%s", "Game Over");
+			PanelPrint(board, 3, (terminalCols / 2) - 19, "%s", playAgainPrompt);
+
+			if (racing)
+			{
+				DrawRanking(game);
+			}
 
-			wrefresh(hud);
-			wrefresh(board);
+			PanelRefresh(hud);
+			PanelRefresh(board);
+			UnlockScreen();
 
 
-			key = getch();
+			key = ReadKey();
 		}
 
 	}
-	pthread_mutex_unlock(&wonLostMutex);
 
-	// Restart the event loop if the user wants to play again.
-	if (key == 'r')
+	return key;
+}
+
+void HandleKey(struct GameContext *game, int key)
+{
+	// Respond to user arrow and keyboard inputs.
+	if (key == KEY_LEFT && game->boardX > 0)
+	{
+		game->boardX--;
+		game->screenX -= 2;
+	}
+
+	if (key == KEY_RIGHT && game->boardX < game->field.cols - 1)
+	{
+		game->boardX++;
+		game->screenX += 2;
+	}
+
+	if (key == KEY_UP && game->boardY > 0)
+	{
+		game->boardY--;
+		game->screenY--;
+	}
+
+	if (key == KEY_DOWN && game->boardY < game->field.rows - 1)
+	{
+		game->boardY++;
+		game->screenY++;
+	}
+
+	if (key == 10)
+	{
+		// When the user presses enter over a space on the grid,
+		// uncover that space.
+		StartGameClock(game);
+		RecordMove(game, REPLAY_REVEAL, game->boardY, game->boardX);
+		game->clicks++;
+		MinefieldReveal(&game->field, game->boardY, game->boardX);
+	}
+
+	if (key == 'f' && MinefieldFlag(&game->field, game->boardY, game->boardX) > 0)
 	{
-		timeout(100);
-		NewGame();
+		// Either flag or unflag the current space.
+		StartGameClock(game);
+		RecordMove(game, REPLAY_FLAG, game->boardY, game->boardX);
+		game->clicks++;
 	}
+
+	if (key == 'c' && MinefieldCanChord(&game->field, game->boardY, game->boardX))
+	{
+		// Chording uncovers everything around a number that has all its
+		// flags. It goes into the replay as a reveal of each tile, so
+		// replays keep the same two kinds of move.
+		StartGameClock(game);
+		game->clicks++;
+
+		for (int i = game->boardY - 1; i <= game->boardY + 1; i++)
+		{
+			for (int j = game->boardX - 1; j <= game->boardX + 1; j++)
+			{
+				if (i >= 0 && i < game->field.rows && j >= 0 && j < game->field.cols &&
+					!MinefieldTile(&game->field, i, j)->isFloodFillMarked && !MinefieldTile(&game->field, i, j)->isFlagged)
+				{
+					RecordMove(game, REPLAY_REVEAL, i, j);
+				}
+			}
+		}
+
+		MinefieldChord(&game->field, game->boardY, game->boardX);
+	}
+
+	// Publish where the game stands for the timer thread. Uncovering a
+	// mine loses the game straight away, so any keys still queued behind
+	// this one aren't applied.
+	game->bombsRemaining = game->field.mines - game->field.flags;
+	game->gameWon = game->field.won;
+	game->gameLost = game->field.lost;
 }
 
-void StartTimer()
+void StartTimer(struct GameContext *game)
 {
 	// Only start the timer once for the entire life of the process.
 	if (!timerStarted)
@@ -450,8 +1205,8 @@ void StartTimer()
 
 					// Spin off a thread to catch the timer events thrown off by
 					// the timer process.
-					res = pthread_create(&a_thread, NULL, TimerThread, NULL);
-					if (res != 0)
+					// The timer thread only ever sees the one game being played.
+					if (pthread_create(&a_thread, NULL, TimerThread, game) != 0)
 					{
 						perror("thread creation failed");
 						exit(EXIT_FAILURE);
@@ -469,8 +1224,43 @@ void StartTimer()
 	}
 }
 
+void RecordMove(struct GameContext *game, enum ReplayAction action, int row, int col)
+{
+	// Add a move on the given tile to the replay, timed from the first move.
+	// Once the replay is full the rest of the game goes unrecorded, and
+	// the score is saved without one.
+	struct ReplayMove move;
+
+	if (game->replaying)
+	{
+		return;
+	}
+
+	move.ms = (MonotonicNanos() - game->gameStartNanos) / 1000000;
+	move.action = action;
+	move.row = row;
+	move.col = col;
+
+	ReplayAppend(&game->replay, &move);
+}
+
+void StartGameClock(struct GameContext *game)
+{
+	// The clock starts on the first move of the game rather than
+	// when the board is drawn, so only the first call does anything.
+	if (game->gameStartNanos == 0)
+	{
+		game->gameStartNanos = MonotonicNanos();
+
+		// Restart the HUD timer so it agrees with the game clock.
+		game->seconds = 0;
+	}
+}
+
 void *TimerThread(void *arg)
 {
+	struct GameContext *game = arg;
+
 	while (read(pipes[0], readBuffer, sizeof(readBuffer)) > 0)
 	{
 		// Until EOF is received by the timer process,
@@ -478,17 +1268,18 @@ void *TimerThread(void *arg)
 		//	then write the new time to the screen
 		read(pipes[0], readBuffer, sizeof(readBuffer));
 
-		pthread_mutex_lock(&secondsMutex);
-		seconds++;
-		pthread_mutex_unlock(&secondsMutex);
+		game->seconds++;
 
+		// Never wait on the screen from here. The HUD is marked out of
+		// date before trying for the screen, so whoever has it either
+		// sees the mark or lets go in time for this to get it.
+		game->hudDirty = true;
 
-		pthread_mutex_lock(&wonLostMutex);
-		if (!gameWon && !gameLost)
+		if (!DrawDirtyHud(game))
 		{
-			PrintHud();
+			screenLockStats.skipped++;
 		}
-		pthread_mutex_unlock(&wonLostMutex);
+
 		memset(readBuffer, '\0', sizeof(readBuffer));
 	}
 
@@ -506,46 +1297,47 @@ void SIGTERMHandler(int sig)
 	exit(0);
 }
 
-void PrintBoard()
+void PrintBoard(struct GameContext *game)
 {
+	long long frameStart = MonotonicNanos();
+
 	// Get a mutex for writing to the screens.
-	pthread_mutex_lock(&screenMutex);
-	wclear(board);
-	int currentY = initialY;
-	int currentX = initialX;
+	LockScreen();
+	PanelClear(board);
+	int currentY = game->initialY;
+	int currentX = game->initialX;
 
 	// Write out the board from the starting point.
-	for (int i = 0; i < gridRows; i++)
+	for (int i = 0; i < game->field.rows; i++)
 	{
-		for (int j = 0; j < gridCols; j++)
+		for (int j = 0; j < game->field.cols; j++)
 		{
-			if (grid[i][j].isFloodFillMarked)
+			const struct Tile *tile = MinefieldTile(&game->field, i, j);
+
+			if (tile->isFloodFillMarked)
 			{
-				if (grid[i][j].isMine)
+				if (tile->isMine)
 				{
 					// If the current space is a mine that has been clicked on,
-					// get a lock for the lost boolean and mark it true.
-					mvwprintw(board, currentY, currentX, "%s", "X");
-					pthread_mutex_lock(&wonLostMutex);
-					gameLost = true;
-					pthread_mutex_unlock(&wonLostMutex);
+					// show the mine that lost the game.
+					PanelPrint(board, currentY, currentX, "%s", "X");
 				}
 				else
 				{
 					// Otherwise, if the space has been clicked on,
 					// print out the number of adjacent mines.
-					mvwprintw(board, currentY, currentX, "%d", grid[i][j].adjacentMines);
+					PanelPrint(board, currentY, currentX, "%d", tile->adjacentMines);
 				}
 			}
-			else if (grid[i][j].isFlagged)
+			else if (tile->isFlagged)
 			{
 				// If the space has been flagged, mark it accordingly.
-				mvwprintw(board, currentY, currentX, "%s", "F");
+				PanelPrint(board, currentY, currentX, "%s", "F");
 			}
 			else
 			{
 				// Otherwise, mark the space with a generic starting character.
-				mvwprintw(board, currentY, currentX, "%s", "-");
+				PanelPrint(board, currentY, currentX, "%s", "-");
 			}
 
 			// Jump 2 spaces to the left, because there is an extra space
@@ -557,430 +1349,1865 @@ void PrintBoard()
 		currentY++;
 
 		// Start the columns back over again.
-		currentX = initialX;
+		currentX = game->initialX;
+	}
+
+	PanelPrint(board, 13, 7, "%s", "Restart-(r) \tQuit-(q)\tFlag-(f)\tClick-(enter)\tChord-(c)");
+
+	if (racing)
+	{
+		DrawRanking(game);
 	}
 
-	mvwprintw(board, 13, 7, "%s", "Restart-(r) \tQuit-(q)\tFlag-(f)\tClick-(enter)");
+	// Catch up on a HUD update the timer thread had to skip.
+	if (atomic_exchange(&game->hudDirty, false))
+	{
+		DrawHud(game);
+		PanelRefresh(hud);
+	}
 
 	// Move the cursor back to where the user
 	// had it.
-	wmove(board, screenY, screenX);
+	PanelMove(board, game->screenY, game->screenX);
 
-	wrefresh(board);
-	pthread_mutex_unlock(&screenMutex);
-}
+	PanelRefresh(board);
+	UnlockScreen();
 
-void PrintHud()
-{
-	// Get a mutex lock for writing to the screen.
-	pthread_mutex_lock(&screenMutex);
+	// The timer may have marked the HUD after it was checked above.
+	DrawDirtyHud(game);
 
-	// Write out all the static info.
-	wclear(hud);
-	mvwprintw(hud, 1, (COLS / 2) - 6, "%s", "MINESWEEPER");
-	char *diff;
+	FrameCompleted(frameStart);
+}
 
-	// Dynamically determine the difficulty.
-	switch(difficulty)
+bool DrawDirtyHud(struct GameContext *game)
+{
+	// Draw the HUD if it's out of date and the game is still going,
+	// unless someone else has the screen. The game state is only
+	// trusted once the screen is held, so nothing lands on top of the
+	// end of game messages.
+	if (!TryLockScreen())
 	{
-		case 0:
-			diff = "Easy";
-			break;
-
-		case 1:
-			diff = "Normal";
-			break;
-
-		case 2:
-			diff = "Hard";
-			break;
+		return false;
 	}
 
-	// Get a mutex lock for reading the seconds count.
-	pthread_mutex_lock(&secondsMutex);
-	if (seconds % 60 < 10)
+	if (atomic_exchange(&game->hudDirty, false) && !game->gameWon && !game->gameLost)
 	{
-		// If there are less than 10 seconds remaining, write out an extra zero in the time
-		// string so that it looks consistent with 2 digits.
-		mvwprintw(hud, 3, (COLS / 2) - 30, "Difficulty: %s\tBombs Remaining: %d\tTime: %d:0%d", diff, bombsRemaining, (seconds / 60), (seconds % 60));
-	}
-	else
-	{
-		mvwprintw(hud, 3, (COLS / 2) - 30, "Difficulty: %s\tBombs Remaining: %d\tTime: %d:%d", diff, bombsRemaining, (seconds / 60), (seconds % 60));
+		DrawHud(game);
+		PanelRefresh(hud);
+		PanelMove(board, game->screenY, game->screenX);
+		PanelRefresh(board);
 	}
-	pthread_mutex_unlock(&secondsMutex);
 
-	// Move the cursor back to where it was
-	// over the gameboard so the user can see
-	// what they're doing.
-	wmove(board, screenY, screenX);
+	UnlockScreen();
+	return true;
+}
+
+void DrawRanking(struct GameContext *game)
+{
+	// The race standings, to the right of the board, with a > by this
+	// player. The caller holds the screen.
+	struct RaceRow rows[RACE_MAX_PLAYERS];
+	int count = RaceRanking(rows);
+	int x = (terminalCols / 2) + game->field.cols + 4;
+	int safeTiles = game->field.rows * game->field.cols - game->field.mines;
 
-	wrefresh(hud);
-	wrefresh(board);
+	PanelPrint(board, game->initialY, x, "%s", "Race");
 
-	pthread_mutex_unlock(&screenMutex);
+	for (int i = 0; i < count && i < RACE_RANKING_ROWS; i++)
+	{
+		PanelPrint(board, game->initialY + 1 + i, x, "%2d%c%-10.10s %3d%% %s", i + 1,
+				   rows[i].id == raceStart.id ? '>' : ' ', rows[i].name, rows[i].uncovered * 100 / safeTiles,
+				   rows[i].state == 'W' ? "won" : rows[i].state == 'L' ? "out" : "   ");
+	}
 }
 
-void Click(int i, int j)
+void ReportRaceProgress(struct GameContext *game)
 {
-	FloodFill(i, j);
+	// Tell the coordinator how many safe tiles are uncovered and
+	// whether the game is over. Nothing is sent if neither changed.
+	int count = game->field.rows * game->field.cols;
+	int uncovered = 0;
+
+	for (int i = 0; i < count; i++)
+	{
+		uncovered += game->tiles[i].isFloodFillMarked && !game->tiles[i].isMine;
+	}
+
+	RaceReport(uncovered, game->gameWon ? 'W' : game->gameLost ? 'L' : 'P');
 }
 
-void FloodFillRecurse(int i, int j)
+void *RaceThread(void *arg)
 {
-	// Determine whether to recursively call FloodFill
-	// on a given tile based on whether or not it is a mine
-	// and whether it's already marked as open.
-	if (!grid[i][j].isMine && !grid[i][j].isFloodFillMarked)
+	struct GameContext *game = arg;
+
+	// Redraw the standings as soon as the coordinator changes them.
+	// Like the timer thread, never wait on the screen: if the input
+	// loop has it, its next frame draws them anyway.
+	while (RaceReceive())
 	{
-		grid[i][j].isFloodFillMarked = true;
+		if (!TryLockScreen())
+		{
+			continue;
+		}
 
-		if (grid[i][j].adjacentMines == 0)
+		// The won screen draws them itself once the name is in.
+		if (game->askingName)
 		{
-			FloodFill(i, j);
+			UnlockScreen();
+			continue;
 		}
+
+		DrawRanking(game);
+		PanelMove(board, game->screenY, game->screenX);
+		PanelRefresh(board);
+		UnlockScreen();
+		DrawDirtyHud(game);
 	}
+
+	return NULL;
+}
+
+void PublishGame(struct GameContext *game)
+{
+	// Send any spectators what the last move changed. This never waits
+	// on them, and does nothing if nobody can watch.
+	SpectatePublish(&game->field, game->boardY, game->boardX, game->seconds);
 }
 
-void FloodFill(int i, int j)
+void WatchGame(const char *path)
 {
-	// Validate that i and j are within bounds.
-	if (i < gridRows && j < gridCols)
+	// Follow a game being played with -publish until it ends or the
+	// spectator quits.
+	struct sockaddr_un address;
+	char input[8192];
+	int inputLength = 0;
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	snprintf(address.sun_path, sizeof(address.sun_path), "%s", path);
+
+	if (fd < 0 || connect(fd, (struct sockaddr *) &address, sizeof(address)) != 0)
+	{
+		fprintf(stderr, "There's no game to watch on %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	InitializeMutexes();
+	InitializeScreens();
+	SetKeyTimeout(0);
+
+	while (ReadKey() != 'q')
 	{
-		// Mark the tile as clicked if it isn't flagged.
-		if (!grid[i][j].isFlagged)
+		struct pollfd wait = { fd, POLLIN, 0 };
+
+		if (poll(&wait, 1, 100) <= 0)
 		{
-			grid[i][j].isFloodFillMarked = true;
+			continue;
 		}
 
-		// If it's an empty non-mine tile, recursively call
-		// FloodFill through FloodFill recurse on all adjacent
-		// tiles.
-		if (grid[i][j].adjacentMines == 0 && !grid[i][j].isMine)
+		ssize_t count = read(fd, input + inputLength, sizeof(input) - inputLength);
+
+		if (count <= 0)
 		{
-			if (!i == 0)
-			{
-				FloodFillRecurse(i - 1, j);
-			}
+			break;
+		}
 
-			if (!(i == gridRows - 1))
-			{
-				FloodFillRecurse(i + 1, j);
-			}
+		inputLength += count;
 
-			if (!j == 0)
-			{
-				FloodFillRecurse(i, j - 1);
-			}
+		// Apply every whole line, then draw once.
+		char *start = input;
+		char *newline;
 
-			if (!(j == gridCols - 1))
-			{
-				FloodFillRecurse(i, j + 1);
-			}
+		while ((newline = memchr(start, '\n', input + inputLength - start)) != NULL)
+		{
+			*newline = '\0';
 
-			if (i < (gridRows - 1) && j < (gridCols - 1))
+			if (!ApplyWatchLine(start))
 			{
-				FloodFillRecurse(i + 1, j + 1);
+				inputLength = 0;
+				break;
 			}
 
-			if (i < (gridRows - 1) && j > 0)
-			{
-				FloodFillRecurse(i + 1, j - 1);
-			}
+			start = newline + 1;
+		}
 
-			if (i > 0 && j < (gridCols - 1))
-			{
-				FloodFillRecurse(i - 1, j + 1);
-			}
+		if (inputLength > 0)
+		{
+			inputLength -= start - input;
+			memmove(input, start, inputLength);
+		}
 
-			if (i > 0 && j > 0)
-			{
-				FloodFillRecurse(i - 1, j - 1);
-			}
+		if (inputLength == sizeof(input))
+		{
+			break;
 		}
+
+		DrawWatchedGame();
 	}
+
+	close(fd);
+	ShutdownScreens();
+	free(watchedTiles);
 }
 
-static int SQLTest(void *notUsed, int argc, char **argv, char **azColName)
+bool ApplyWatchLine(char *line)
 {
-	// This function determines whether a given score is high
-	// enough to go into the database.
-	int count = atoi(argv[0]);
+	// Take in a whole board or a set of changes. Returns false if the
+	// line makes no sense.
+	int offset;
+
+	if (sscanf(line + 1, " %c %d %d %d %d%n", &watchedState, &watchedMinesLeft, &watchedSeconds, &watchedRow,
+			   &watchedCol, &offset) != 5)
+	{
+		return false;
+	}
+
+	char *at = line + 1 + offset;
 
-    if (count >= 10)
-    {
-    	int lowestScore = atoi(argv[2]);
+	if (line[0] == 'B')
+	{
+		int rows;
+		int cols;
 
-		if (score < lowestScore)
+		if (sscanf(at, " %d %d %n", &rows, &cols, &offset) != 2 || rows < 1 || cols < 1 ||
+			(long long) strlen(at + offset) != rows * ((long long) cols + 1) - 1)
 		{
-			// If there are more than 10 entries in the database and
-			// this score isn't higher than the lowest of them, it's
-			// not going into the database.
-			return 0;
+			return false;
 		}
-    }
 
-	// Otherwise, we can ask the user for their name.
-	nocbreak();
-	echo();
+		// Only take on the new size once there's room for it, so a failed
+		// allocation leaves nothing pointing at tiles that aren't there.
+		if (rows * cols != watchedRows * watchedCols)
+		{
+			char *tiles = malloc(rows * cols);
 
-	mvwprintw(board, 5, (COLS / 2) - 10, "%s", "Please enter name: ");
+			if (tiles == NULL)
+			{
+				return false;
+			}
 
-	wrefresh(board);
+			free(watchedTiles);
+			watchedTiles = tiles;
+		}
 
-	wgetstr(board, name);
+		watchedRows = rows;
+		watchedCols = cols;
+		at += offset;
 
-	cbreak();
-	noecho();
+		for (int i = 0; i < rows; i++)
+		{
+			memcpy(watchedTiles + i * cols, at + i * (cols + 1), cols);
+		}
 
-	// And run the SQL query to add them to the database.
-	if (count >= 10)
-	{
-		sprintf(sql, "delete from scores where id = %d; \ninsert into scores(name, score) values(\"%s\", %d);", atoi(argv[1]), name, score);
+		return true;
 	}
-    else
-    {
-    	sprintf(sql, "insert into scores(name, score) values(\"%s\", %d);", name, score);
-    }
 
-	res = sqlite3_exec(db, sql, NULL, 0, &zErrorMsg);
+	int count;
 
-	if (res != SQLITE_OK)
+	if (line[0] != 'D' || watchedTiles == NULL || sscanf(at, " %d%n", &count, &offset) != 1)
 	{
-		fprintf(stderr, "SQL error1: %s\n", zErrorMsg);
-		sqlite3_free(zErrorMsg);
-		exit(1);
+		return false;
 	}
 
-	// Give the user feedback that their score is safe.
-	wclear(board);
-	mvwprintw(board, 1, (COLS / 2) - 15, "%s", "Your score has been saved");
-	wrefresh(board);
+	at += offset;
 
-	// And return.
-    return SQLITE_OK;
-}
-
-void ViewScores()
-{
-	strcpy(sql, "select name, score from scores order by score desc;");
+	for (int i = 0; i < count; i++)
+	{
+		int row;
+		int col;
+		char tile;
 
-	sqlResults = false;
+		if (sscanf(at, " %d:%d:%c%n", &row, &col, &tile, &offset) != 3 || row < 0 || row >= watchedRows ||
+			col < 0 || col >= watchedCols)
+		{
+			return false;
+		}
 
-  	res = sqlite3_exec(db, sql, ViewScoresSQL, 0, &zErrorMsg);
-	if (res != SQLITE_OK)
-	{
-		fprintf(stderr, "SQL error2: %s\n", zErrorMsg);
-		sqlite3_free(zErrorMsg);
-		exit(1);
+		watchedTiles[row * watchedCols + col] = tile;
+		at += offset;
 	}
 
-	if (!sqlResults)
-	{
-		printf("No scores yet. Play a game and add one!\n");
-	}
+	return true;
 }
 
-static int ViewScoresSQL(void *notUsed, int argc, char **argv, char **azColName)
+void DrawWatchedGame()
 {
-	// Determine whether there are any scores to show.
-	if (argv[0] != '\0')
+	// Draw the game the way the player sees it, with their cursor.
+	const char *state = watchedState == 'W' ? "Won" : watchedState == 'L' ? "Lost" : "Playing";
+	int initialX = (terminalCols / 2) - watchedCols;
+
+	if (watchedTiles == NULL)
 	{
-		// If so, let the calling function know
-		sqlResults = true;
-		for (int i = 0; i < argc; i += 2)
-		{
-			// Loop through and print out the scores.
-			printf("%s", argv[i]);
+		return;
+	}
 
-			for (int j = 0; j < 10 - strlen(argv[i]); j++)
-			{
-				printf(" ");
-			}
+	LockScreen();
+	PanelClear(hud);
+	PanelClear(board);
 
-			printf("%s\n", argv[i + 1]);
+	PanelPrint(hud, 1, (terminalCols / 2) - 8, "%s", "WATCHING A GAME");
+	PanelPrint(hud, 3, (terminalCols / 2) - 30, "%s\tBombs Remaining: %d\tTime: %d:%02d",
+			   state, watchedMinesLeft, watchedSeconds / 60, watchedSeconds % 60);
+
+	for (int i = 0; i < watchedRows; i++)
+	{
+		for (int j = 0; j < watchedCols; j++)
+		{
+			PanelPrint(board, 1 + i, initialX + j * 2, "%c", watchedTiles[i * watchedCols + j]);
 		}
 	}
 
-	return 0;
-}
-
-void Usage()
-{
-	printf("Usage: minesweeper\n");
-	printf("\t   -e (Easy)\n");
-	printf("\t   -n (Normal)\n");
-	printf("\t   -h (Hard)\n");
-	printf("\t   -s (View High Scores)\n");
+	PanelPrint(board, watchedRows + 3, 7, "%s", "Quit-(q)");
+	PanelMove(board, 1 + watchedRow, initialX + watchedCol * 2);
 
-	exit(1);
+	PanelRefresh(hud);
+	PanelRefresh(board);
+	UnlockScreen();
 }
 
-void CalculateAdjacentBombs()
+void PrintHud(struct GameContext *game)
 {
-	// Calculate the mines adjacent to each
-	// non mine position in the grid.
-	for (int i = 0; i < gridRows; i++)
-	{
-		for (int j = 0; j < gridCols; j++)
-		{
-			if (!grid[i][j].isMine)
-			{
-				int adjacentMines = 0;
+	long long frameStart = MonotonicNanos();
 
-				if (!i == 0)
-				{
-					if (grid[i - 1][j].isMine)
-					{
-						adjacentMines++;
-					}
-				}
-
-				if (!(i == gridRows - 1))
-				{
-					if (grid[i + 1][j].isMine)
-					{
-						adjacentMines++;
-					}
-				}
+	// Get a mutex lock for writing to the screen.
+	LockScreen();
 
-				if (!j == 0)
-				{
-					if (grid[i][j - 1].isMine)
-					{
-						adjacentMines++;
-					}
-				}
+	DrawHud(game);
 
-				if (!(j == gridCols - 1))
-				{
-					if (grid[i][j + 1].isMine)
-					{
-						adjacentMines++;
-					}
-				}
+	PanelRefresh(hud);
+	PanelRefresh(board);
 
-				if (i < (gridRows - 1) && j < (gridCols - 1))
-				{
-					if (grid[i + 1][j + 1].isMine)
-					{
-						adjacentMines++;
-					}
-				}
+	UnlockScreen();
 
-				if (i < (gridRows - 1) && j > 0)
-				{
-					if (grid[i + 1][j - 1].isMine)
-					{
-						adjacentMines++;
-					}
-				}
+	FrameCompleted(frameStart);
+}
 
-				if (i > 0 && j < (gridCols - 1))
-				{
-					if (grid[i - 1][j + 1].isMine)
-					{
-						adjacentMines++;
-					}
-				}
+void FrameCompleted(long long frameStart)
+{
+	// Called by the input loop once a frame has been written out
+	// to the terminal. Any key waiting on a frame is now visible.
+	long long now = MonotonicNanos();
 
-				if (i > 0 && j > 0)
-				{
-					if (grid[i - 1][j - 1].isMine)
-					{
-						adjacentMines++;
-					}
-				}
+	HistogramRecord(&renderTime, now - frameStart);
 
-				grid[i][j].adjacentMines = adjacentMines;
-			}
-		}
+	if (startupNanos == 0)
+	{
+		startupNanos = now - processStartNanos;
 	}
-}
 
-void PlaceBombs()
+	if (pendingKeyNanos != 0)
+	{
+		HistogramRecord(&inputLatency, now - pendingKeyNanos);
+		pendingKeyNanos = 0;
+	}
+
+	// Counting the bytes can mean reading /proc, so only do it
+	// when someone asked for the numbers.
+	if (statsEnabled)
+	{
+		long long written = TerminalBytesWritten();
+
+		HistogramRecord(&frameBytes, written - lastFrameBytes);
+		lastFrameBytes = written;
+	}
+}
+
+void DrawHud(struct GameContext *game)
+{
+	// Write out all the static info.
+	PanelClear(hud);
+	PanelPrint(hud, 1, (terminalCols / 2) - 6, "%s", "MINESWEEPER");
+	char *diff;
+
+	// Dynamically determine the difficulty.
+	switch(game->difficulty)
+	{
+		case 0:
+			diff = "Easy";
+			break;
+
+		case 1:
+			diff = "Normal";
+			break;
+
+		case 2:
+			diff = "Hard";
+			break;
+	}
+
+	// Take one snapshot of the shared counters for this draw.
+	int hudSeconds = game->seconds;
+	int hudBombs = game->bombsRemaining;
+
+	if (hudSeconds % 60 < 10)
+	{
+		// If there are less than 10 seconds remaining, write out an extra zero in the time
+		// string so that it looks consistent with 2 digits.
+		PanelPrint(hud, 3, (terminalCols / 2) - 30, "Difficulty: %s\tBombs Remaining: %d\tTime: %d:0%d", diff, hudBombs, (hudSeconds / 60), (hudSeconds % 60));
+	}
+	else
+	{
+		PanelPrint(hud, 3, (terminalCols / 2) - 30, "Difficulty: %s\tBombs Remaining: %d\tTime: %d:%d", diff, hudBombs, (hudSeconds / 60), (hudSeconds % 60));
+	}
+
+	// Move the cursor back to where it was
+	// over the gameboard so the user can see
+	// what they're doing.
+	PanelMove(board, game->screenY, game->screenX);
+}
+
+void SaveHighScore(struct GameContext *game)
+{
+	// This function determines whether a given score is high
+	// enough to go into the database.
+	struct Placing placing;
+
+	int res = ScoreStorePlace(game->difficulty, game->scoreMs, HIGH_SCORE_PLACES, &placing);
+
+	if (res != SQLITE_OK)
+	{
+		// Other players may have the database tied up. Say so
+		// on the win screen rather than quitting the game.
+		*game->saveStatus = SCORE_FAILED;
+		return;
+	}
+
+	if (!placing.qualifies)
+	{
+		// If the table is full and this score isn't higher than
+		// the last one on it, it's not going into the database.
+		return;
+	}
+
+	// Otherwise, we can tell them where they placed and ask for their name.
+	// Nothing else draws until they've typed it.
+	game->askingName = true;
+
+	LockScreen();
+	PanelPrint(board, 4, (terminalCols / 2) - 10, "That's number %d on the table!", placing.rank);
+	PanelPrint(board, 5, (terminalCols / 2) - 10, "%s", "Please enter name: ");
+	UnlockScreen();
+
+	PanelGetString(board, game->name, sizeof(game->name));
+	game->askingName = false;
+
+	// And queue them to be added to the database, bumping the lowest
+	// score off this difficulty's table if it's full. The writer thread
+	// updates saveStatus once the score is safely committed.
+	res = ScoreStoreQueue(game->name, game->difficulty, game->field.rows, game->field.cols, game->score, game->scoreMs,
+						  HIGH_SCORE_PLACES, game->replay.full ? NULL : &game->replay, game->gameMillis, game->saveStatus);
+
+	if (res != SQLITE_OK)
+	{
+		*game->saveStatus = SCORE_FAILED;
+	}
+}
+
+atomic_int *NextSaveStatus(struct GameContext *game)
+{
+	// Find a status slot no save is still writing to. If every one is
+	// in use, wait for the saves to finish.
+	for (int i = 0; i < SAVE_STATUS_SLOTS; i++)
+	{
+		if (game->saveStatuses[i] != SCORE_SAVING)
+		{
+			game->saveStatuses[i] = SCORE_UNSAVED;
+			return &game->saveStatuses[i];
+		}
+	}
+
+	ScoreStoreFlush();
+	game->saveStatuses[0] = SCORE_UNSAVED;
+	return &game->saveStatuses[0];
+}
+
+void RecordGame(struct GameContext *game)
+{
+	// Queue the game that just finished for the history. It's written
+	// in the background along with any high score.
+	struct GameRecord record;
+
+	record.seed = game->gameSeed;
+	record.difficulty = game->difficulty;
+	record.rows = game->field.rows;
+	record.cols = game->field.cols;
+	record.mines = game->field.mines;
+	record.won = game->gameWon;
+	record.durationMs = game->gameMillis;
+	record.threeBV = Minefield3BV(&game->field);
+	record.clicks = game->clicks;
+	record.playedAt = 0;
+
+	ScoreStoreQueueGame(&record, NULL);
+}
+
+void StressTest(int writers)
 {
-	// Randomly place numberOfBombs in the grid array.
-	srand((unsigned)time(NULL));
-	int bombRow;
-	int bombCol;
+	// Start a number of processes that all save winning scores into
+	// one database as fast as they can, the way players sharing a
+	// scores.db do, and report how many commits got through per second.
+	// A scratch database is used so the real high scores are left alone.
+	const char *path = "stress.db";
+
+	unlink(path);
+	unlink("stress.db-wal");
+	unlink("stress.db-shm");
+
+	// Create the schema up front so the writers don't all race to.
+	if (ScoreStoreOpen(path) != SQLITE_OK)
+	{
+		fprintf(stderr, "Can't open database: %s\n", ScoreStoreError());
+		exit(EXIT_FAILURE);
+	}
 
-	for (int i = 0; i < numberOfBombs; i++)
+	ScoreStoreClose();
+
+	long long start = MonotonicNanos();
+
+	for (int i = 0; i < writers; i++)
 	{
-		bombRow = rand() % gridRows;
-		bombCol = rand() % gridCols;
+		switch (fork())
+		{
+			case -1:
+				perror("fork failed");
+				exit(1);
+
+			case 0:
+			{
+				int failures = 0;
+				struct Placing placing;
+
+				srand(getpid());
+
+				if (ScoreStoreOpen(path) != SQLITE_OK)
+				{
+					exit(STRESS_WINS);
+				}
+
+				for (int j = 0; j < STRESS_WINS; j++)
+				{
+					int winDifficulty = rand() % 3;
+					int winMs = rand() % 1000000;
+
+					if (ScoreStorePlace(winDifficulty, winMs, HIGH_SCORE_PLACES, &placing) != SQLITE_OK ||
+						ScoreStoreInsert("stress", winDifficulty, GRID_ROWS, GRID_COLS, winMs / 1000, winMs,
+										 HIGH_SCORE_PLACES) != SQLITE_OK)
+					{
+						failures++;
+					}
+				}
+
+				ScoreStoreClose();
+				exit(failures);
+			}
+		}
+	}
 
-		if (grid[bombRow][bombCol].isMine)
+	// Each writer exits with the number of saves that failed.
+	int failures = 0;
+	int status;
+
+	while (wait(&status) > 0)
+	{
+		if (WIFEXITED(status))
 		{
-			i--;
+			failures += WEXITSTATUS(status);
 		}
 		else
 		{
-			grid[bombRow][bombCol].isMine = true;
+			failures += STRESS_WINS;
 		}
 	}
+
+	double elapsed = (MonotonicNanos() - start) / 1e9;
+	int commits = writers * STRESS_WINS - failures;
+
+	printf("%d writers, %d commits, %d failed in %.2f s: %.0f commits/sec\n",
+		   writers, commits, failures, elapsed, commits / elapsed);
 }
 
-void InitializeGrid()
+void ViewScores()
 {
-	// Set the array of Tile structs to their
-	// initial starting values.
-	for (int i = 0; i < gridRows; i++)
+	// Show every difficulty's table, or just the one asked for.
+	for (int i = 0; i < 3; i++)
 	{
-		for (int j = 0; j < gridCols; j++)
+		if (viewDifficulty != -1 && viewDifficulty != i)
+		{
+			continue;
+		}
+
+		sqlResults = false;
+
+		printf("%s\n", difficultyNames[i]);
+		int res = ScoreStoreTop(i, HIGH_SCORE_PLACES, ViewScoresRow);
+
+		if (res != SQLITE_OK && !NoScoresYet(res))
+		{
+			fprintf(stderr, "SQL error2: %s\n", ScoreStoreError());
+			exit(1);
+		}
+
+		if (!sqlResults)
 		{
-			grid[i][j].isMine = false;
-			grid[i][j].isFlagged = false;
-			grid[i][j].is3BVMarked = false;
-			grid[i][j].isFloodFillMarked = false;
-			grid[i][j].adjacentMines = 0;
+			printf("No scores yet. Play a game and add one!\n");
 		}
 	}
 }
 
-void InitializeScreens()
+void OpenScoresForViewing()
+{
+	// The high score tables come from minesweeperd if it's running,
+	// in which case the database is never opened at all.
+	ScoreStoreUseDaemon(SCORE_DAEMON_SOCKET);
+	ScoreStoreOpenReadOnly("scores.db");
+}
+
+bool NoScoresYet(int res)
+{
+	// Looking at the scores never creates the database, so one that
+	// can't be opened because it isn't there just has nothing in it.
+	return res == SQLITE_CANTOPEN && access("scores.db", F_OK) != 0;
+}
+
+void ExportScores(const char *path)
 {
-	// Setup ncurses and the 2 screens that will
-	// be used, 1 for the HUD and one for the gameboard.
-	initscr();
+	// Write the high scores and game history out for another host to
+	// import, and say how quickly it went. The rows go to a file beside
+	// the one asked for, which only replaces it once they're all there,
+	// so a failed export leaves the last one as it was.
+	long long rows;
+	char temporary[strlen(path) + 5];
+
+	snprintf(temporary, sizeof(temporary), "%s.tmp", path);
+
+	FILE *out = fopen(temporary, "w");
+
+	if (out == NULL)
+	{
+		perror(temporary);
+		exit(EXIT_FAILURE);
+	}
+
+	// Exporting never creates the database.
+	ScoreStoreOpenReadOnly("scores.db");
+
+	long long start = MonotonicNanos();
+	int res = ScoreStoreExport(out, &rows);
+	double elapsed = (MonotonicNanos() - start) / 1e9;
+
+	bool closed = fclose(out) == 0;
+
+	if (res != SQLITE_OK)
+	{
+		fprintf(stderr, "Export failed: %s\n", ScoreStoreError());
+		unlink(temporary);
+		exit(EXIT_FAILURE);
+	}
+
+	if (!closed || rename(temporary, path) != 0)
+	{
+		perror(path);
+		unlink(temporary);
+		exit(EXIT_FAILURE);
+	}
 
-    hud = newwin(5, COLS, 0, 0);
-    board = newwin(LINES - 5, COLS, 5, 0);
+	ScoreStoreClose();
 
-    cbreak();
-	noecho();
-	timeout(100);
-	keypad(stdscr, TRUE);
+	printf("Exported %lld rows in %.2f s: %.0f rows/sec\n", rows, elapsed, rows / (elapsed > 0 ? elapsed : 1e-9));
 }
 
-void InitializeMutexes()
+void ImportScores(const char *path)
 {
-	// Create and verify the 3 mutexes needed
-	// for dealing with the variables that are
-	// manipulated by the thread and the main
-	// process.
+	// Merge an export from another host into scores.db, and say how
+	// much of it was new and how quickly it went.
+	long long rows;
+	long long added;
+	FILE *in = fopen(path, "r");
+
+	if (in == NULL)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
 
-	res = pthread_mutex_init(&secondsMutex, NULL);
+	int res = ScoreStoreOpen("scores.db");
 
-	if (res != 0)
+	if (res != SQLITE_OK)
 	{
-		perror("Seconds mutex initialization failed");
+		fprintf(stderr, "Can't open database: %s\n", ScoreStoreError());
 		exit(EXIT_FAILURE);
 	}
 
-	res = pthread_mutex_init(&screenMutex, NULL);
+	long long start = MonotonicNanos();
+	res = ScoreStoreImport(in, HIGH_SCORE_PLACES, &rows, &added);
+	double elapsed = (MonotonicNanos() - start) / 1e9;
 
-	if (res != 0)
+	fclose(in);
+
+	if (res != SQLITE_OK)
 	{
-		perror("Screen mutex initialization failed");
+		fprintf(stderr, "Import failed after %lld rows: %s\n", rows, ScoreStoreError());
 		exit(EXIT_FAILURE);
 	}
 
-	res = pthread_mutex_init(&wonLostMutex, NULL);
+	ScoreStoreClose();
 
-	if (res != 0)
+	printf("Imported %lld rows (%lld new) in %.2f s: %.0f rows/sec\n",
+		   rows, added, elapsed, rows / (elapsed > 0 ? elapsed : 1e-9));
+}
+
+void BenchQueries(int count)
+{
+	// Time the same mix of high score queries through minesweeperd, if
+	// it's running, and straight from the database.
+	struct Placing placing;
+	double daemonElapsed = 0;
+
+	OpenScoresForViewing();
+
+	if (ScoreStorePlace(0, 0, HIGH_SCORE_PLACES, &placing) == SQLITE_OK && ScoreClientConnected())
+	{
+		daemonElapsed = TimeQueries(count);
+		printf("minesweeperd: %d queries in %.2f s: %.0f queries/sec\n", count, daemonElapsed, count / daemonElapsed);
+	}
+	else
+	{
+		printf("minesweeperd isn't running on %s\n", SCORE_DAEMON_SOCKET);
+	}
+
+	ScoreStoreUseDaemon(NULL);
+
+	double sqliteElapsed = TimeQueries(count);
+	printf("sqlite: %d queries in %.2f s: %.0f queries/sec\n", count, sqliteElapsed, count / sqliteElapsed);
+
+	if (daemonElapsed > 0)
+	{
+		printf("minesweeperd is %.1fx the speed of sqlite\n", sqliteElapsed / daemonElapsed);
+	}
+
+	ScoreStoreClose();
+}
+
+double TimeQueries(int count)
+{
+	// Alternate between reading a top ten and placing a random score,
+	// across all three difficulties.
+	struct Placing placing;
+	long long start = MonotonicNanos();
+
+	for (int i = 0; i < count; i++)
+	{
+		int res;
+
+		if (i % 2 == 0)
+		{
+			res = ScoreStoreTop(i % 3, HIGH_SCORE_PLACES, BenchQueriesRow);
+		}
+		else
+		{
+			res = ScoreStorePlace(i % 3, rand() % 1000000, HIGH_SCORE_PLACES, &placing);
+		}
+
+		if (res != SQLITE_OK)
+		{
+			fprintf(stderr, "SQL error: %s\n", ScoreStoreError());
+			exit(1);
+		}
+	}
+
+	return (MonotonicNanos() - start) / 1e9;
+}
+
+void BenchQueriesRow(const char *rowName, int rowScoreMs)
+{
+}
+
+void Simulate(int games)
+{
+	// Play the same games with a simple bot on one thread, then on more
+	// and more, each thread with its own GameContext. Report how fast
+	// it went, and check every run came out exactly like the first.
+	struct SimulationTotals first;
+	struct SimulationTotals totals;
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpus < 1)
+	{
+		cpus = 1;
+	}
+	else if (cpus > SIMULATION_MAX_THREADS)
+	{
+		cpus = SIMULATION_MAX_THREADS;
+	}
+
+	for (int threads = 1; threads <= cpus; threads = threads * 2 <= cpus || threads == cpus ? threads * 2 : cpus)
+	{
+		long long start = MonotonicNanos();
+		RunSimulation(games, threads, &totals);
+		double elapsed = (MonotonicNanos() - start) / 1e9;
+
+		printf("%2d threads: %d games in %.2f s: %.0f games/sec, %.0f moves/sec\n", threads, games, elapsed,
+			   games / elapsed, totals.moves / elapsed);
+
+		if (threads == 1)
+		{
+			first = totals;
+			printf("%lld wins, %lld moves, %lld 3BV\n", totals.wins, totals.moves, totals.threeBV);
+		}
+		else if (memcmp(&first, &totals, sizeof(totals)) != 0)
+		{
+			fprintf(stderr, "%d threads played differently: %lld wins, %lld moves, %lld 3BV\n", threads,
+					totals.wins, totals.moves, totals.threeBV);
+			exit(1);
+		}
+	}
+}
+
+void RunSimulation(int games, int threads, struct SimulationTotals *totals)
+{
+	struct SimulationWorker workers[SIMULATION_MAX_THREADS];
+	atomic_int nextGame = 0;
+
+	memset(totals, 0, sizeof(*totals));
+
+	for (int i = 0; i < threads; i++)
+	{
+		memset(&workers[i].totals, 0, sizeof(workers[i].totals));
+		workers[i].nextGame = &nextGame;
+		workers[i].games = games;
+
+		if (pthread_create(&workers[i].thread, NULL, SimulationThread, &workers[i]) != 0)
+		{
+			perror("thread creation failed");
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	for (int i = 0; i < threads; i++)
+	{
+		pthread_join(workers[i].thread, NULL);
+
+		totals->games += workers[i].totals.games;
+		totals->wins += workers[i].totals.wins;
+		totals->moves += workers[i].totals.moves;
+		totals->threeBV += workers[i].totals.threeBV;
+	}
+}
+
+void *SimulationThread(void *arg)
+{
+	struct SimulationWorker *worker = arg;
+	struct GameContext *game = malloc(sizeof(*game));
+
+	if (game == NULL)
 	{
-		perror("Won / Lost Mutex initialization failed");
+		perror("Can't simulate");
 		exit(EXIT_FAILURE);
 	}
+
+	int i;
+
+	while ((i = atomic_fetch_add(worker->nextGame, 1)) < worker->games)
+	{
+		// Game i is always dealt and played the same way, on
+		// whichever difficulty it falls on.
+		InitializeGame(game, i % 3);
+		game->gameSeed = i + 1;
+		DealBoard(game);
+
+		worker->totals.moves += PlaySimulatedGame(game, i + 1);
+		worker->totals.wins += game->gameWon;
+		worker->totals.threeBV += Minefield3BV(&game->field);
+		worker->totals.games++;
+	}
+
+	free(game);
+	return NULL;
+}
+
+int PlaySimulatedGame(struct GameContext *game, unsigned moveSeed)
+{
+	// Play the game out through the same key handling a player uses.
+	// Every move uncovers or flags a tile, so it always ends.
+	int moves = 0;
+
+	while (!game->gameWon && !game->gameLost)
+	{
+		HandleKey(game, ChooseSimulatedMove(game, &moveSeed));
+		moves++;
+	}
+
+	return moves;
+}
+
+int ChooseSimulatedMove(struct GameContext *game, unsigned *moveSeed)
+{
+	// Put the cursor on the next tile to play and return the key to
+	// press there. A number with as many flags around it as it says is
+	// safe to clear around; one with only as many covered tiles around
+	// it as it says has a mine under each. Otherwise guess.
+	int covered = 0;
+
+	struct Minefield *field = &game->field;
+
+	for (int i = 0; i < field->rows; i++)
+	{
+		for (int j = 0; j < field->cols; j++)
+		{
+			const struct Tile *tile = MinefieldTile(field, i, j);
+
+			if (!tile->isFloodFillMarked)
+			{
+				covered += !tile->isFlagged;
+				continue;
+			}
+
+			int flags = 0;
+			int hidden = 0;
+			int hiddenRow = 0;
+			int hiddenCol = 0;
+
+			for (int di = -1; di <= 1; di++)
+			{
+				for (int dj = -1; dj <= 1; dj++)
+				{
+					int ni = i + di;
+					int nj = j + dj;
+
+					if (ni < 0 || ni >= field->rows || nj < 0 || nj >= field->cols ||
+						MinefieldTile(field, ni, nj)->isFloodFillMarked)
+					{
+						continue;
+					}
+
+					if (MinefieldTile(field, ni, nj)->isFlagged)
+					{
+						flags++;
+					}
+					else
+					{
+						hidden++;
+						hiddenRow = ni;
+						hiddenCol = nj;
+					}
+				}
+			}
+
+			if (hidden > 0 && (flags == tile->adjacentMines || flags + hidden == tile->adjacentMines))
+			{
+				game->boardY = hiddenRow;
+				game->boardX = hiddenCol;
+				return flags == tile->adjacentMines ? 10 : 'f';
+			}
+		}
+	}
+
+	// Pick one of the covered tiles at random.
+	int pick = rand_r(moveSeed) % covered;
+
+	for (int i = 0; i < field->rows; i++)
+	{
+		for (int j = 0; j < field->cols; j++)
+		{
+			if (!MinefieldTile(field, i, j)->isFloodFillMarked && !MinefieldTile(field, i, j)->isFlagged && pick-- == 0)
+			{
+				game->boardY = i;
+				game->boardX = j;
+			}
+		}
+	}
+
+	return 10;
+}
+
+void Lockstep(int games, int checkEvery)
+{
+	// Play games with the simulation bot and log their inputs, then
+	// follow each log on a second board dealt from the same seed. Every
+	// check has to pass, and both boards have to end up the same. Then
+	// follow each log again, slipping in a flag the player never made,
+	// and see how soon the checks catch it.
+	struct GameContext *host = malloc(sizeof(*host));
+	struct GameContext *peer = malloc(sizeof(*peer));
+	struct LockstepLog *log = malloc(sizeof(*log));
+	long long inputs = 0;
+	long long bytes = 0;
+	long long checks = 0;
+	long long followNanos = 0;
+	long long desyncs = 0;
+	long long caught = 0;
+	long long lateness = 0;
+	long long latest = 0;
+
+	if (host == NULL || peer == NULL || log == NULL)
+	{
+		perror("Can't run lockstep games");
+		exit(EXIT_FAILURE);
+	}
+
+	for (int i = 0; i < games; i++)
+	{
+		unsigned moveSeed = i + 1;
+
+		InitializeGame(host, i % 3);
+		host->gameSeed = i + 1;
+		DealBoard(host);
+		LockstepReset(log, host->gameSeed, host->field.rows, host->field.cols, host->field.mines, checkEvery);
+
+		// The bot has no clock of its own, so each move is a tick.
+		while (!host->gameWon && !host->gameLost)
+		{
+			int key = ChooseSimulatedMove(host, &moveSeed);
+			struct LockstepInput input = {
+				log->inputs, key == 'f' ? LOCKSTEP_FLAG : LOCKSTEP_REVEAL, host->boardY, host->boardX
+			};
+
+			HandleKey(host, key);
+
+			if (!LockstepAppend(log, &host->field, &input))
+			{
+				fprintf(stderr, "Game %d doesn't fit in a lockstep log\n", i + 1);
+				exit(1);
+			}
+		}
+
+		inputs += log->inputs;
+		bytes += log->length;
+
+		long long start = MonotonicNanos();
+		int desyncAt = FollowLog(peer, log, 0, &checks);
+
+		followNanos += MonotonicNanos() - start;
+
+		if (desyncAt > 0 || MinefieldHash(&peer->field) != MinefieldHash(&host->field))
+		{
+			fprintf(stderr, "Game %d came out differently from its inputs, at input %d\n", i + 1, desyncAt);
+			exit(1);
+		}
+
+		// Go wrong somewhere there's a check still to come.
+		int lastCheck = log->inputs / checkEvery * checkEvery;
+
+		if (lastCheck < 1)
+		{
+			continue;
+		}
+
+		int divergeAfter = 1 + rand_r(&moveSeed) % lastCheck;
+		long long ignored = 0;
+
+		desyncs++;
+		desyncAt = FollowLog(peer, log, divergeAfter, &ignored);
+
+		if (desyncAt > 0)
+		{
+			caught++;
+			lateness += desyncAt - divergeAfter;
+			latest = desyncAt - divergeAfter > latest ? desyncAt - divergeAfter : latest;
+		}
+	}
+
+	printf("%d games, %lld inputs, checked every %d inputs\n", games, inputs, checkEvery);
+	printf("%.1f bytes a game, %.2f bytes an input, checks included\n", (double) bytes / games,
+		   (double) bytes / inputs);
+	printf("followed at %.0f inputs/sec, %lld checks passed\n", inputs / (followNanos / 1e9), checks);
+	printf("%lld of %lld desyncs caught, %.2f inputs after going wrong on average, %lld at most\n", caught, desyncs,
+		   desyncs > 0 ? (double) lateness / desyncs : 0, latest);
+
+	free(host);
+	free(peer);
+	free(log);
+
+	if (caught != desyncs)
+	{
+		fprintf(stderr, "%lld desyncs went unnoticed\n", desyncs - caught);
+		exit(1);
+	}
+}
+
+int FollowLog(struct GameContext *peer, const struct LockstepLog *log, int divergeAfter, long long *checks)
+{
+	// Deal the log's board and apply it. After input divergeAfter, if
+	// it's above 0, flag or unflag the first covered tile, as though
+	// the peer had made a move of its own. Returns the input a check
+	// failed after, or 0 if none did.
+	struct LockstepFollower follower;
+
+	InitializeGame(peer, 0);
+	MinefieldReset(&peer->field, log->mines, log->seed);
+	LockstepFollowerReset(&follower, log->cols, log->checkEvery);
+
+	for (int i = 0; i < log->length; i++)
+	{
+		switch (LockstepFollow(&follower, &peer->field, log->data[i]))
+		{
+			case LOCKSTEP_APPLIED:
+				if (follower.inputs == divergeAfter)
+				{
+					int tile = 0;
+
+					while (peer->field.tiles[tile].isFloodFillMarked)
+					{
+						tile++;
+					}
+
+					MinefieldFlag(&peer->field, tile / log->cols, tile % log->cols);
+				}
+
+				break;
+
+			case LOCKSTEP_IN_SYNC:
+				(*checks)++;
+				break;
+
+			case LOCKSTEP_DESYNC:
+				return follower.inputs;
+
+			case LOCKSTEP_MORE:
+				break;
+		}
+	}
+
+	return 0;
+}
+
+void ListReplays()
+{
+	OpenScoresForViewing();
+
+	sqlResults = false;
+	int res = ScoreStoreListReplays(ListReplaysRow);
+
+	if (res != SQLITE_OK && !NoScoresYet(res))
+	{
+		fprintf(stderr, "SQL error: %s\n", ScoreStoreError());
+		exit(1);
+	}
+
+	if (!sqlResults)
+	{
+		printf("No replays yet. Save a high score to keep one!\n");
+	}
+
+	ScoreStoreClose();
+}
+
+void ListReplaysRow(const struct ReplayInfo *info, const char *replayName)
+{
+	if (!sqlResults)
+	{
+		printf("%6s  %-10s%-10s%10s%8s%8s\n", "Id", "Name", "Level", "Time", "Moves", "Bytes");
+		sqlResults = true;
+	}
+
+	printf("%6d  %-10s%-10s%10.3f%8d%8d\n", info->id, replayName,
+		   info->difficulty >= 0 && info->difficulty <= 2 ? difficultyNames[info->difficulty] : "?",
+		   info->durationMs / 1000.0, info->moves, info->size);
+}
+
+void ViewReplay(int id)
+{
+	// Deal the replay's board again from its seed, then play its moves
+	// onto it, printing each one, and show how the board ended up.
+	struct ReplayInfo info;
+	struct GameContext *game = malloc(sizeof(*game));
+
+	if (game == NULL)
+	{
+		perror("Can't play a replay");
+		exit(EXIT_FAILURE);
+	}
+
+	OpenScoresForViewing();
+
+	int res = ScoreStoreFindReplay(id, &info);
+
+	if (res == SQLITE_NOTFOUND || NoScoresYet(res))
+	{
+		fprintf(stderr, "There's no replay %d. Run with -replays to list them.\n", id);
+		exit(1);
+	}
+
+	InitializeGame(game, info.difficulty);
+	game->gameSeed = info.seed;
+	DealBoard(game);
+	game->replaying = true;
+
+	if (res != SQLITE_OK || info.rows != game->field.rows || info.cols != game->field.cols ||
+		info.mines != game->field.mines)
+	{
+		fprintf(stderr, "Can't read replay %d: %s\n", id, ScoreStoreError());
+		exit(1);
+	}
+
+	replayGame = game;
+	res = ScoreStoreReadReplay(&info, ViewReplayMove);
+
+	if (res == SQLITE_CORRUPT)
+	{
+		fprintf(stderr, "Replay %d is corrupt\n", id);
+		exit(1);
+	}
+
+	if (res != SQLITE_OK)
+	{
+		fprintf(stderr, "Can't read replay %d: %s\n", id, ScoreStoreError());
+		exit(1);
+	}
+
+	printf("\n");
+
+	for (int i = 0; i < game->field.rows; i++)
+	{
+		for (int j = 0; j < game->field.cols; j++)
+		{
+			const struct Tile *tile = MinefieldTile(&game->field, i, j);
+
+			if (tile->isFloodFillMarked)
+			{
+				printf(tile->isMine ? "X " : "%d ", tile->adjacentMines);
+			}
+			else
+			{
+				printf("%s ", tile->isFlagged ? "F" : tile->isMine ? "*" : "-");
+			}
+		}
+
+		printf("\n");
+	}
+
+	printf("\n%s in %.3f s, %d moves, %d bytes\n", game->gameWon ? "Won" : game->gameLost ? "Lost" : "Unfinished",
+		   info.durationMs / 1000.0, info.moves, info.size);
+
+	free(game);
+	ScoreStoreClose();
+}
+
+void ViewReplayMove(const struct ReplayMove *move)
+{
+	// Make the move just like the player did, through the same key handling.
+	printf("%8.3f  %-6s %d,%d\n", move->ms / 1000.0, move->action == REPLAY_FLAG ? "flag" : "reveal",
+		   move->row, move->col);
+
+	struct GameContext *game = replayGame;
+
+	game->boardY = move->row;
+	game->boardX = move->col;
+	HandleKey(game, move->action == REPLAY_FLAG ? 'f' : 10);
+}
+
+void ViewStats()
+{
+	sqlResults = false;
+
+	int res = ScoreStoreGameStats(ViewStatsRow);
+
+	if (res != SQLITE_OK && !NoScoresYet(res))
+	{
+		fprintf(stderr, "SQL error: %s\n", ScoreStoreError());
+		exit(1);
+	}
+
+	if (!sqlResults)
+	{
+		printf("No games yet. Play one first!\n");
+	}
+}
+
+void ViewStatsRow(const struct GameStats *stats)
+{
+	// Print the header before the first row, then one line per difficulty.
+	if (!sqlResults)
+	{
+		printf("%-10s%8s%8s%8s%10s%8s\n", "", "Games", "Wins", "Win %", "Best", "3BV/s");
+		sqlResults = true;
+	}
+
+	printf("%-10s%8d%8d%8.1f", stats->difficulty >= 0 && stats->difficulty <= 2 ? difficultyNames[stats->difficulty] : "?",
+		   stats->games, stats->wins, stats->games > 0 ? stats->wins * 100.0 / stats->games : 0);
+
+	if (stats->bestMs >= 0)
+	{
+		printf("%10.3f%8.2f\n", stats->bestMs / 1000.0, stats->mean3BVPerSecond);
+	}
+	else
+	{
+		printf("%10s%8s\n", "-", "-");
+	}
+}
+
+void ViewScoresRow(const char *scoreName, int rowScoreMs)
+{
+	// Let the calling function know there was something to show,
+	// then print the score. Scores are stored in thousandths of a point.
+	sqlResults = true;
+
+	printf("%-10s%.3f\n", scoreName, rowScoreMs / 1000.0);
+}
+
+void Usage()
+{
+	printf("Usage: minesweeper\n");
+	printf("\t   -e (Easy)\n");
+	printf("\t   -n (Normal)\n");
+	printf("\t   -h (Hard)\n");
+	printf("\t   -s [e|n|h] (View High Scores)\n");
+	printf("\t   -S (View Game Statistics)\n");
+	printf("\t   -stats [file] (Print timing counters on exit)\n");
+	printf("\t   -renderer ncurses|ansi (Choose how the game is drawn)\n");
+	printf("\t   -stress N (Time N processes saving scores at once)\n");
+	printf("\t   -export file (Write the scores and game history to a CSV file)\n");
+	printf("\t   -import file (Merge a CSV file from -export into the scores)\n");
+	printf("\t   -bench-queries N (Time N high score queries with and without minesweeperd)\n");
+	printf("\t   -simulate N (Time N bot games on more and more threads)\n");
+	printf("\t   -server path (Serve games to any number of clients on a UNIX socket)\n");
+	printf("\t   -load path N (Time N connections playing games on a -server)\n");
+	printf("\t   -race-host path N (With -e, -n or -h, hold a race between N players on the same board)\n");
+	printf("\t   -race path [name] (Join a race)\n");
+	printf("\t   -publish path (Let spectators watch the game on a UNIX socket)\n");
+	printf("\t   -watch path (Watch a game being played with -publish)\n");
+	printf("\t   -bot-protocol (Play games for a bot over stdin and stdout, as -server does)\n");
+	printf("\t   -bot-script N (Write the requests for N perfect games, for -bot-protocol)\n");
+	printf("\t   -lockstep N [every] (Check N bot games come out the same from their inputs, hashing every 8 or [every] moves)\n");
+	printf("\t   -coop-bench N (Time 1 to 64 players clearing an N by N board together)\n");
+	printf("\t   -soak N (With -e, -n or -h, restart a game N times and report the memory used)\n");
+	printf("\t   -replays (List the replays kept with high scores)\n");
+	printf("\t   -replay id (Play back a replay)\n");
+
+	exit(1);
+}
+
+void InitializeScreens()
+{
+	// Setup the 2 screens that will be used, 1 for
+	// the HUD and one for the gameboard.
+	int lines;
+
+	if (ansiRenderer)
+	{
+		if (!AnsiInit())
+		{
+			fprintf(stderr, "The ANSI renderer needs a terminal\n");
+			exit(EXIT_FAILURE);
+		}
+
+		lines = AnsiLines();
+		terminalCols = AnsiCols();
+	}
+	else
+	{
+		// ncurses writes straight to its terminal's file descriptor, so to
+		// tell its output apart from everything else the process writes,
+		// -stats gives it a terminal of its own to write to.
+		FILE *in = stdin;
+		FILE *out = stdout;
+
+		if (statsEnabled && !StartCountedTerminal(&in, &out))
+		{
+			fprintf(stderr, "Can't count what ncurses writes without a terminal\n");
+			exit(EXIT_FAILURE);
+		}
+
+		if (newterm(NULL, out, in) == NULL)
+		{
+			StopCountedTerminal();
+			fprintf(stderr, "Can't start ncurses\n");
+			exit(EXIT_FAILURE);
+		}
+
+		lines = LINES;
+		terminalCols = COLS;
+
+		hud->window = newwin(5, COLS, 0, 0);
+		board->window = newwin(LINES - 5, COLS, 5, 0);
+
+		cbreak();
+		noecho();
+		keypad(stdscr, TRUE);
+	}
+
+	hud->top = 0;
+	hud->rows = 5;
+	board->top = 5;
+	board->rows = lines - 5;
+
+	SetKeyTimeout(100);
+
+	// Only count what's written from here on towards the first frame.
+	if (statsEnabled)
+	{
+		lastFrameBytes = TerminalBytesWritten();
+	}
+}
+
+void ShutdownScreens()
+{
+	// Put the terminal back the way we found it.
+	if (ansiRenderer)
+	{
+		AnsiShutdown();
+	}
+	else
+	{
+		echo();
+		nocbreak();
+		endwin();
+		StopCountedTerminal();
+	}
+}
+
+void PanelClear(struct Panel *panel)
+{
+	if (ansiRenderer)
+	{
+		AnsiClear(panel->top, panel->rows);
+	}
+	else
+	{
+		wclear(panel->window);
+	}
+}
+
+void PanelPrint(struct Panel *panel, int y, int x, const char *format, ...)
+{
+	// Format once, then hand the text to whichever renderer is in use.
+	char text[256];
+	va_list args;
+
+	va_start(args, format);
+	vsnprintf(text, sizeof(text), format, args);
+	va_end(args);
+
+	if (ansiRenderer)
+	{
+		AnsiPrint(panel->top + y, x, text);
+	}
+	else
+	{
+		mvwprintw(panel->window, y, x, "%s", text);
+	}
+}
+
+void PanelMove(struct Panel *panel, int y, int x)
+{
+	if (ansiRenderer)
+	{
+		AnsiMoveCursor(panel->top + y, x);
+	}
+	else
+	{
+		wmove(panel->window, y, x);
+	}
+}
+
+void PanelRefresh(struct Panel *panel)
+{
+	// The ANSI renderer always sends the whole screen's changes at
+	// once, so refreshing a second panel in the same frame sends nothing.
+	if (ansiRenderer)
+	{
+		ansiBytes += AnsiFlush();
+	}
+	else
+	{
+		wrefresh(panel->window);
+	}
+}
+
+void PanelGetString(struct Panel *panel, char *buffer, int size)
+{
+	// Read a line of text with echo on, starting where the
+	// last thing was printed.
+	if (ansiRenderer)
+	{
+		ansiBytes += AnsiGetLine(buffer, size);
+	}
+	else
+	{
+		nocbreak();
+		echo();
+
+		wrefresh(panel->window);
+		wgetnstr(panel->window, buffer, size - 1);
+
+		cbreak();
+		noecho();
+	}
+}
+
+int ReadKey()
+{
+	// Wait up to the current key timeout for a key.
+	if (soakRestarts > 0)
+	{
+		return SoakKey();
+	}
+
+	if (ansiRenderer)
+	{
+		return AnsiGetKey(keyTimeout);
+	}
+
+	return getch();
+}
+
+int SoakKey()
+{
+	// Play the next key of the -soak script, and quit once the last
+	// restart is done.
+	int key = soakKeys[soakKey];
+
+	soakKey = (soakKey + 1) % (sizeof(soakKeys) / sizeof(soakKeys[0]));
+
+	if (key == 'r')
+	{
+		soakDone++;
+		SoakSample();
+
+		if (soakDone == soakRestarts)
+		{
+			return 'q';
+		}
+	}
+
+	return key;
+}
+
+void SoakCheckDeal(struct GameContext *game)
+{
+	// A board dealt over the last one, clearing only the tiles it
+	// touched, has to be the same as one dealt onto a blank board.
+	static struct Tile tiles[GRID_ROWS * GRID_COLS];
+	static int work[GRID_ROWS * GRID_COLS];
+	struct Minefield fresh;
+
+	MinefieldInit(&fresh, game->field.rows, game->field.cols, tiles, work);
+	MinefieldReset(&fresh, game->field.mines, game->gameSeed);
+
+	if (MinefieldHash(&fresh) != MinefieldHash(&game->field))
+	{
+		soakMismatches++;
+	}
+}
+
+void SoakSample()
+{
+	// Note how much memory the session holds once it has settled in,
+	// and at the end, to show it stays the same in between.
+	if (soakDone == SOAK_SETTLED)
+	{
+		soakSettledKilobytes = ResidentKilobytes();
+	}
+
+	if (soakDone == soakRestarts)
+	{
+		soakFinalKilobytes = ResidentKilobytes();
+	}
+}
+
+void SoakReport()
+{
+	double elapsed = (MonotonicNanos() - soakStartNanos) / 1e9;
+
+	printf("%d restarts in %.2f s (%.0f a second)\n", soakDone, elapsed, soakDone / elapsed);
+	printf("resident memory: %ld kB after %d restarts, %ld kB after %d\n", soakSettledKilobytes, SOAK_SETTLED,
+		   soakFinalKilobytes, soakDone);
+	printf("%d of the boards dealt differed from the same board dealt from scratch\n", soakMismatches);
+}
+
+long ResidentKilobytes()
+{
+	// The second number in statm is the resident set, in pages.
+	long pages = 0;
+	FILE *statm = fopen("/proc/self/statm", "r");
+
+	if (statm == NULL)
+	{
+		return 0;
+	}
+
+	if (fscanf(statm, "%*d %ld", &pages) != 1)
+	{
+		pages = 0;
+	}
+
+	fclose(statm);
+	return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+void SetKeyTimeout(int millis)
+{
+	keyTimeout = millis;
+
+	if (!ansiRenderer)
+	{
+		timeout(millis);
+	}
+}
+
+long long TerminalBytesWritten()
+{
+	// Only what went to the terminal, not the database's writes or the
+	// bytes sent to spectators and racers.
+	return ansiRenderer ? ansiBytes : cursesBytes;
+}
+
+bool StartCountedTerminal(FILE **in, FILE **out)
+{
+	// Open a pseudo terminal the same size and with the same settings as
+	// the real one, for ncurses to use in its place. The real one is put
+	// in raw mode, all but its signal keys, since the pseudo terminal
+	// does the echoing and line editing ncurses asks for.
+	struct winsize size;
+	struct termios raw;
+
+	if (tcgetattr(STDIN_FILENO, &countedSaved) != 0 || ioctl(STDOUT_FILENO, TIOCGWINSZ, &size) != 0)
+	{
+		return false;
+	}
+
+	countedMaster = posix_openpt(O_RDWR | O_NOCTTY);
+
+	if (countedMaster < 0 || grantpt(countedMaster) != 0 || unlockpt(countedMaster) != 0 ||
+		(countedSlave = open(ptsname(countedMaster), O_RDWR | O_NOCTTY)) < 0 || pipe(countedStop) != 0)
+	{
+		StopCountedTerminal();
+		return false;
+	}
+
+	tcsetattr(countedSlave, TCSANOW, &countedSaved);
+	ioctl(countedSlave, TIOCSWINSZ, &size);
+
+	raw = countedSaved;
+	cfmakeraw(&raw);
+	raw.c_lflag |= ISIG;
+	tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+	*in = fdopen(countedSlave, "r");
+	*out = fdopen(dup(countedSlave), "w");
+
+	if (*in == NULL || *out == NULL || pthread_create(&countedThread, NULL, RelayTerminal, NULL) != 0)
+	{
+		StopCountedTerminal();
+		return false;
+	}
+
+	countedRunning = true;
+	return true;
+}
+
+void *RelayTerminal(void *arg)
+{
+	// Pass ncurses' output on to the real terminal, counting it, and
+	// the keys typed there on to ncurses, until told to stop.
+	struct pollfd fds[3] = {
+		{ .fd = countedMaster, .events = POLLIN },
+		{ .fd = STDIN_FILENO, .events = POLLIN },
+		{ .fd = countedStop[0], .events = POLLIN }
+	};
+
+	while (true)
+	{
+		if (poll(fds, 3, -1) <= 0)
+		{
+			continue;
+		}
+
+		bool stopping = fds[2].revents != 0;
+
+		// Once told to stop, only pass on what's left of the output.
+		if (stopping && poll(fds, 1, 0) <= 0)
+		{
+			break;
+		}
+
+		if (fds[0].revents != 0)
+		{
+			Relay(countedMaster, STDOUT_FILENO, &fds[0], &cursesBytes);
+		}
+
+		if (!stopping && fds[1].revents != 0)
+		{
+			Relay(STDIN_FILENO, countedMaster, &fds[1], NULL);
+		}
+	}
+
+	return NULL;
+}
+
+void Relay(int from, int to, struct pollfd *watch, atomic_llong *counter)
+{
+	// Pass on one read's worth, and stop watching from once it has
+	// nothing more to give.
+	char buffer[4096];
+	ssize_t count = read(from, buffer, sizeof(buffer));
+
+	if (count <= 0)
+	{
+		watch->fd = -1;
+		return;
+	}
+
+	if (counter != NULL)
+	{
+		*counter += count;
+	}
+
+	for (ssize_t sent = 0, written; sent < count; sent += written)
+	{
+		written = write(to, buffer + sent, count - sent);
+
+		if (written <= 0)
+		{
+			return;
+		}
+	}
+}
+
+void StopCountedTerminal()
+{
+	// Wait for ncurses' last output to reach the real terminal, then
+	// put that back the way it was.
+	if (countedRunning)
+	{
+		tcdrain(countedSlave);
+
+		if (write(countedStop[1], "", 1) == 1)
+		{
+			pthread_join(countedThread, NULL);
+		}
+
+		countedRunning = false;
+	}
+
+	if (countedMaster >= 0)
+	{
+		tcsetattr(STDIN_FILENO, TCSANOW, &countedSaved);
+	}
+
+	for (int i = 0; i < 2; i++)
+	{
+		if (countedStop[i] >= 0)
+		{
+			close(countedStop[i]);
+			countedStop[i] = -1;
+		}
+	}
+
+	if (countedMaster >= 0)
+	{
+		close(countedMaster);
+		countedMaster = -1;
+	}
+}
+
+void InitializeMutexes()
+{
+	// Create and verify the mutex that keeps the
+	// thread and the main process from drawing
+	// to the screen at the same time. Everything
+	// else they share is atomic.
+	int res = pthread_mutex_init(&screenMutex, NULL);
+
+	if (res != 0)
+	{
+		perror("Screen mutex initialization failed");
+		exit(EXIT_FAILURE);
+	}
+}
+
+void LockScreen()
+{
+	// Take the screen, keeping track of how long we had to wait for it.
+	long long requested = MonotonicNanos();
+
+	if (pthread_mutex_trylock(&screenMutex) != 0)
+	{
+		pthread_mutex_lock(&screenMutex);
+		screenLockStats.contended++;
+	}
+
+	screenLockStats.lockedAt = MonotonicNanos();
+	screenLockStats.waitNanos += screenLockStats.lockedAt - requested;
+	screenLockStats.acquisitions++;
+}
+
+bool TryLockScreen()
+{
+	// Take the screen only if nobody else has it.
+	if (pthread_mutex_trylock(&screenMutex) != 0)
+	{
+		return false;
+	}
+
+	screenLockStats.lockedAt = MonotonicNanos();
+	screenLockStats.acquisitions++;
+
+	return true;
+}
+
+void UnlockScreen()
+{
+	// Record how long the screen was held before letting it go.
+	long long held = MonotonicNanos() - screenLockStats.lockedAt;
+
+	screenLockStats.holdNanos += held;
+
+	if (held > screenLockStats.maxHoldNanos)
+	{
+		screenLockStats.maxHoldNanos = held;
+	}
+
+	pthread_mutex_unlock(&screenMutex);
+}
+
+void WriteStats()
+{
+	// Print the stats if they were asked for, to the
+	// file given with -stats or to stderr.
+	if (!statsEnabled)
+	{
+		return;
+	}
+
+	FILE *statsFile = stderr;
+
+	if (statsPath != NULL && (statsFile = fopen(statsPath, "w")) == NULL)
+	{
+		perror("Couldn't open stats file");
+		statsFile = stderr;
+	}
+
+	PrintStats(statsFile);
+
+	if (statsFile != stderr)
+	{
+		fclose(statsFile);
+	}
+}
+
+void PrintStats(FILE *out)
+{
+	// Dump the counters collected while the game was running.
+	struct LockStats *lock = &screenLockStats;
+
+	fprintf(out, "screen lock: %lld acquisitions, %lld contended, %lld timer skips\n",
+			lock->acquisitions, lock->contended, lock->skipped);
+
+	if (lock->acquisitions > 0)
+	{
+		fprintf(out, "screen lock hold: mean %lld ns, max %lld ns; wait: mean %lld ns\n",
+				lock->holdNanos / lock->acquisitions, lock->maxHoldNanos,
+				lock->waitNanos / lock->acquisitions);
+	}
+
+	fprintf(out, "startup: %.3f ms\n", startupNanos / 1e6);
+
+	HistogramPrint(out, "input to screen", &inputLatency, 1000.0, "us");
+	HistogramPrint(out, "frame render", &renderTime, 1000.0, "us");
+	HistogramPrint(out, "keys per frame", &keysPerFrame, 1.0, "keys");
+	ScoreStorePrintStats(out);
+	HistogramPrint(out, ansiRenderer ? "bytes per frame (ansi)" : "bytes per frame (ncurses)",
+			&frameBytes, 1.0, "bytes");
 }
\ No newline at end of file
@@ -0,0 +1,624 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - high score daemon
+
+#include <poll.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <sqlite3.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "stats.h"
+#include "replay.h"
+#include "scorestore.h"
+#include "scoreclient.h"
+
+// minesweeperd holds each difficulty's high score table in a sorted
+// array and answers TOP and PLACE from memory. SAVE updates the array
+// straight away and hands the score to the score store's writer thread,
+// but only answers once the writer has committed it, so a client never
+// hears its score is saved when it isn't. Once a second it checks
+// whether anything else has written to the database, and if so reloads
+// the tables from it.
+
+#define DIFFICULTIES 3
+#define MAX_CLIENTS 1024
+#define RELOAD_CHECK_MS 1000
+// How often to look for committed saves while a client waits on one.
+#define SAVE_CHECK_MS 2
+
+void Usage();
+void LoadTables();
+void LoadTableRow(const char *name, int scoreMs);
+void CheckForReload();
+int Listen(const char *path);
+void AcceptClient();
+void ReadClient(int index);
+void HandleLines(int index);
+void DropClient(int index);
+void HandleRequest(int index, char *line);
+void Reply(int index, const char *text, int length);
+struct Table;
+int CountAbove(struct Table *table, int scoreMs);
+void HandleTop(int index, char *arguments);
+void HandlePlace(int index, char *arguments);
+void HandleSave(int index, char *arguments);
+bool SavesWaiting(bool orDropped);
+void AnswerSaves();
+void Shutdown(int sig);
+
+struct Entry {
+	int scoreMs;
+	char name[SCORE_NAME_LENGTH];
+};
+
+// Best score first, like the database's index.
+struct Table {
+	struct Entry entries[SCORE_DAEMON_TOP_LIMIT];
+	int count;
+};
+
+struct Client {
+	char input[SCORE_DAEMON_LINE_LENGTH];
+	int length;
+};
+
+// A save on the writer thread's queue, and the socket of the client
+// waiting to hear how it went, or -1 once nobody is. The slot is free
+// again once the save is done and nobody is waiting.
+struct Save {
+	atomic_int status;
+	int fd;
+};
+
+struct Table tables[DIFFICULTIES];
+struct Table *loading;
+
+struct pollfd polls[MAX_CLIENTS + 1];
+struct Client clients[MAX_CLIENTS + 1];
+int pollCount;
+
+struct Save saves[MAX_CLIENTS];
+
+int dataVersion;
+volatile sig_atomic_t stopping = false;
+long long requests;
+
+int main(int argc, char *argv[])
+{
+	const char *databasePath = "scores.db";
+	const char *socketPath = SCORE_DAEMON_SOCKET;
+
+	for (int i = 1; i < argc; i++)
+	{
+		if (strcmp(argv[i], "-db") == 0 && i + 1 < argc)
+		{
+			databasePath = argv[++i];
+		}
+		else if (strcmp(argv[i], "-socket") == 0 && i + 1 < argc)
+		{
+			socketPath = argv[++i];
+		}
+		else
+		{
+			Usage();
+		}
+	}
+
+	if (ScoreStoreOpen(databasePath) != SQLITE_OK)
+	{
+		fprintf(stderr, "Can't open database: %s\n", ScoreStoreError());
+		exit(EXIT_FAILURE);
+	}
+
+	LoadTables();
+
+	for (int i = 0; i < MAX_CLIENTS; i++)
+	{
+		saves[i].status = SCORE_SAVED;
+		saves[i].fd = -1;
+	}
+
+	polls[0].fd = Listen(socketPath);
+	polls[0].events = POLLIN;
+	pollCount = 1;
+
+	struct sigaction act;
+	memset(&act, 0, sizeof(act));
+	act.sa_handler = Shutdown;
+	sigaction(SIGTERM, &act, NULL);
+	sigaction(SIGINT, &act, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	printf("minesweeperd: serving %s on %s\n", databasePath, socketPath);
+	fflush(stdout);
+
+	long long lastCheck = MonotonicNanos();
+
+	while (!stopping)
+	{
+		int ready = poll(polls, pollCount, SavesWaiting(false) ? SAVE_CHECK_MS : RELOAD_CHECK_MS);
+
+		if (ready < 0 && errno != EINTR)
+		{
+			perror("poll");
+			break;
+		}
+
+		// Go by the clock, since a daemon that's never idle for a whole
+		// second would otherwise never look.
+		if (MonotonicNanos() - lastCheck >= RELOAD_CHECK_MS * 1000000LL)
+		{
+			CheckForReload();
+			lastCheck = MonotonicNanos();
+		}
+
+		AnswerSaves();
+
+		if (ready <= 0)
+		{
+			continue;
+		}
+
+		// Go backwards so dropping a client, which moves the last one
+		// into its place, doesn't skip anybody.
+		for (int i = pollCount - 1; i >= 1; i--)
+		{
+			if (polls[i].revents != 0)
+			{
+				ReadClient(i);
+			}
+		}
+
+		if (polls[0].revents & POLLIN)
+		{
+			AcceptClient();
+		}
+	}
+
+	// Write out anything still queued before going.
+	close(polls[0].fd);
+	unlink(socketPath);
+	ScoreStoreClose();
+
+	printf("minesweeperd: answered %lld requests\n", requests);
+	return 0;
+}
+
+void Usage()
+{
+	printf("Usage: minesweeperd\n");
+	printf("\t   -db file (The high score database, scores.db by default)\n");
+	printf("\t   -socket path (Where to listen, %s by default)\n", SCORE_DAEMON_SOCKET);
+
+	exit(1);
+}
+
+void Shutdown(int sig)
+{
+	stopping = true;
+}
+
+void LoadTables()
+{
+	// Read every difficulty's table out of the database.
+	for (int i = 0; i < DIFFICULTIES; i++)
+	{
+		loading = &tables[i];
+		loading->count = 0;
+
+		if (ScoreStoreTop(i, SCORE_DAEMON_TOP_LIMIT, LoadTableRow) != SQLITE_OK)
+		{
+			fprintf(stderr, "Can't load scores: %s\n", ScoreStoreError());
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	ScoreStoreDataVersion(&dataVersion);
+}
+
+void LoadTableRow(const char *name, int scoreMs)
+{
+	struct Entry *entry = &loading->entries[loading->count++];
+
+	entry->scoreMs = scoreMs;
+	snprintf(entry->name, sizeof(entry->name), "%s", name);
+}
+
+void CheckForReload()
+{
+	// Only once the daemon's own saves are all written, since until then
+	// the database is behind the tables here, not ahead of them.
+	int version;
+
+	if (SavesWaiting(true) || ScoreStoreDataVersion(&version) != SQLITE_OK || version == dataVersion)
+	{
+		return;
+	}
+
+	LoadTables();
+}
+
+int Listen(const char *path)
+{
+	struct sockaddr_un address;
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (listener < 0 || strlen(path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "Can't listen on %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	// A socket file left behind by a daemon that's gone can be replaced,
+	// but not one that another daemon is still answering on.
+	if (connect(listener, (struct sockaddr *) &address, sizeof(address)) == 0)
+	{
+		fprintf(stderr, "minesweeperd is already running on %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	close(listener);
+	unlink(path);
+	listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 || listen(listener, 128) != 0)
+	{
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+
+	return listener;
+}
+
+void AcceptClient()
+{
+	int client = accept(polls[0].fd, NULL, NULL);
+
+	if (client < 0)
+	{
+		return;
+	}
+
+	if (pollCount == MAX_CLIENTS + 1)
+	{
+		close(client);
+		return;
+	}
+
+	// Replies are small, so a client that stops reading them is dropped
+	// rather than allowed to hold everybody else up.
+	fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+
+	polls[pollCount].fd = client;
+	polls[pollCount].events = POLLIN;
+	clients[pollCount].length = 0;
+	pollCount++;
+}
+
+void DropClient(int index)
+{
+	// Nobody is left to answer about a save the client was waiting on,
+	// and the socket may be reused by someone else.
+	for (int i = 0; i < MAX_CLIENTS; i++)
+	{
+		if (saves[i].fd == polls[index].fd)
+		{
+			saves[i].fd = -1;
+		}
+	}
+
+	close(polls[index].fd);
+	pollCount--;
+
+	if (index != pollCount)
+	{
+		polls[index] = polls[pollCount];
+		memcpy(&clients[index], &clients[pollCount], sizeof(clients[index]));
+	}
+}
+
+void ReadClient(int index)
+{
+	// Take whatever the client sent and answer each whole line in it.
+	struct Client *client = &clients[index];
+	ssize_t count = read(polls[index].fd, client->input + client->length, sizeof(client->input) - client->length);
+
+	if (count <= 0)
+	{
+		if (count == 0 || errno != EAGAIN)
+		{
+			DropClient(index);
+		}
+
+		return;
+	}
+
+	client->length += count;
+	HandleLines(index);
+}
+
+void HandleLines(int index)
+{
+	// Answer each whole line the client has sent, stopping at a save
+	// until it has been answered, so replies go back in order.
+	struct Client *client = &clients[index];
+	char *start = client->input;
+	char *newline;
+
+	while (polls[index].events != 0 && (newline = memchr(start, '\n', client->input + client->length - start)) != NULL)
+	{
+		int fd = polls[index].fd;
+
+		*newline = '\0';
+		HandleRequest(index, start);
+		start = newline + 1;
+
+		// Replying may have dropped the client.
+		if (index >= pollCount || polls[index].fd != fd)
+		{
+			return;
+		}
+	}
+
+	client->length -= start - client->input;
+	memmove(client->input, start, client->length);
+
+	if (client->length == sizeof(client->input))
+	{
+		DropClient(index);
+	}
+}
+
+void Reply(int index, const char *text, int length)
+{
+	if (write(polls[index].fd, text, length) != length)
+	{
+		DropClient(index);
+	}
+}
+
+void HandleRequest(int index, char *line)
+{
+	requests++;
+
+	if (strncmp(line, "TOP ", 4) == 0)
+	{
+		HandleTop(index, line + 4);
+	}
+	else if (strncmp(line, "PLACE ", 6) == 0)
+	{
+		HandlePlace(index, line + 6);
+	}
+	else if (strncmp(line, "SAVE ", 5) == 0)
+	{
+		HandleSave(index, line + 5);
+	}
+	else
+	{
+		Reply(index, "ERR unknown request\n", 20);
+	}
+}
+
+int CountAbove(struct Table *table, int scoreMs)
+{
+	// The number of scores strictly better than scoreMs, by binary search.
+	int low = 0;
+	int high = table->count;
+
+	while (low < high)
+	{
+		int middle = (low + high) / 2;
+
+		if (table->entries[middle].scoreMs > scoreMs)
+		{
+			low = middle + 1;
+		}
+		else
+		{
+			high = middle;
+		}
+	}
+
+	return low;
+}
+
+void HandleTop(int index, char *arguments)
+{
+	// The whole reply goes out in one write.
+	static char reply[SCORE_DAEMON_TOP_LIMIT * (SCORE_NAME_LENGTH + 16) + 16];
+	int difficulty;
+	int limit;
+
+	if (sscanf(arguments, "%d %d", &difficulty, &limit) != 2 || difficulty < 0 || difficulty >= DIFFICULTIES ||
+		limit < 0 || limit > SCORE_DAEMON_TOP_LIMIT)
+	{
+		Reply(index, "ERR bad TOP\n", 12);
+		return;
+	}
+
+	struct Table *table = &tables[difficulty];
+	int count = limit < table->count ? limit : table->count;
+	int length = sprintf(reply, "%d\n", count);
+
+	for (int i = 0; i < count; i++)
+	{
+		length += sprintf(reply + length, "%d %s\n", table->entries[i].scoreMs, table->entries[i].name);
+	}
+
+	Reply(index, reply, length);
+}
+
+void HandlePlace(int index, char *arguments)
+{
+	// Answer exactly as ScoreStorePlace() would from the database.
+	char reply[32];
+	int difficulty;
+	int scoreMs;
+	int places;
+
+	if (sscanf(arguments, "%d %d %d", &difficulty, &scoreMs, &places) != 3 || difficulty < 0 ||
+		difficulty >= DIFFICULTIES || places < 1)
+	{
+		Reply(index, "ERR bad PLACE\n", 14);
+		return;
+	}
+
+	struct Table *table = &tables[difficulty];
+	bool qualifies = table->count < places || scoreMs >= table->entries[places - 1].scoreMs;
+	int rank = qualifies ? CountAbove(table, scoreMs) + 1 : 0;
+
+	Reply(index, reply, sprintf(reply, "%d %d\n", qualifies, rank));
+}
+
+void HandleSave(int index, char *arguments)
+{
+	static struct Replay replay;
+	int difficulty;
+	int rows;
+	int cols;
+	int score;
+	int scoreMs;
+	int places;
+	int durationMs;
+	int consumed = 0;
+
+	if (sscanf(arguments, "%d %d %d %d %d %d %d %n", &difficulty, &rows, &cols, &score, &scoreMs, &places,
+			   &durationMs, &consumed) != 7 || consumed == 0 || difficulty < 0 || difficulty >= DIFFICULTIES ||
+		places < 1)
+	{
+		Reply(index, "ERR bad SAVE\n", 13);
+		return;
+	}
+
+	const char *rest = arguments + consumed;
+	bool hasReplay = *rest != '-';
+
+	if (hasReplay ? !ReplayFromText(&replay, rest, &rest) : *++rest != ' ')
+	{
+		Reply(index, "ERR bad SAVE\n", 13);
+		return;
+	}
+
+	const char *name = *rest == ' ' ? rest + 1 : rest;
+	struct Table *table = &tables[difficulty];
+	int position = CountAbove(table, scoreMs);
+
+	// Put it after any equal scores, even the same player's same time,
+	// as the database does, then trim the table to places.
+	while (position < table->count && table->entries[position].scoreMs == scoreMs)
+	{
+		position++;
+	}
+
+	int limit = places < SCORE_DAEMON_TOP_LIMIT ? places : SCORE_DAEMON_TOP_LIMIT;
+
+	if (position < limit)
+	{
+		int moving = (table->count < limit ? table->count : limit - 1) - position;
+
+		memmove(&table->entries[position + 1], &table->entries[position], moving * sizeof(struct Entry));
+		table->entries[position].scoreMs = scoreMs;
+		snprintf(table->entries[position].name, sizeof(table->entries[position].name), "%s", name);
+		table->count = position + 1 + moving;
+	}
+
+	if (table->count > limit)
+	{
+		table->count = limit;
+	}
+
+	struct Save *save = NULL;
+
+	for (int i = 0; i < MAX_CLIENTS && save == NULL; i++)
+	{
+		if (saves[i].fd < 0 && saves[i].status != SCORE_SAVING)
+		{
+			save = &saves[i];
+		}
+	}
+
+	if (save == NULL || ScoreStoreQueue(name, difficulty, rows, cols, score, scoreMs, places,
+										hasReplay ? &replay : NULL, durationMs, &save->status) != SQLITE_OK)
+	{
+		Reply(index, "ERR can't save\n", 15);
+		return;
+	}
+
+	// Hold the client's answer, and anything else it sends, until the
+	// writer thread is done with the save.
+	save->fd = polls[index].fd;
+	polls[index].events = 0;
+}
+
+bool SavesWaiting(bool orDropped)
+{
+	// Whether any save is still being written that a client is waiting
+	// on, or if orDropped, that anyone was.
+	for (int i = 0; i < MAX_CLIENTS; i++)
+	{
+		if (saves[i].status == SCORE_SAVING && (orDropped || saves[i].fd >= 0))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void AnswerSaves()
+{
+	// Tell each client whose save is done how it went, and go on to
+	// whatever else they've sent.
+	for (int i = 0; i < MAX_CLIENTS; i++)
+	{
+		int fd = saves[i].fd;
+
+		if (fd < 0 || saves[i].status == SCORE_SAVING)
+		{
+			continue;
+		}
+
+		saves[i].fd = -1;
+
+		for (int index = 1; index < pollCount; index++)
+		{
+			if (polls[index].fd != fd)
+			{
+				continue;
+			}
+
+			polls[index].events = POLLIN;
+
+			if (saves[i].status == SCORE_SAVED)
+			{
+				Reply(index, "OK\n", 3);
+			}
+			else
+			{
+				Reply(index, "ERR can't save\n", 15);
+			}
+
+			// Replying may have dropped the client.
+			if (index < pollCount && polls[index].fd == fd)
+			{
+				HandleLines(index);
+			}
+
+			break;
+		}
+	}
+}
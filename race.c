@@ -0,0 +1,649 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - same seed races
+
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#include "race.h"
+#include "stats.h"
+
+// Room for a row of every player, so the latest rows always fit.
+#define RACE_OUTPUT_LENGTH (RACE_MAX_PLAYERS * 48)
+
+// The coordinator's side of one player.
+struct RacePlayer {
+	int fd;
+	bool joined;
+	char input[RACE_LINE_LENGTH];
+	int inputLength;
+	char output[RACE_OUTPUT_LENGTH];
+	int outputLength;
+	int outputSent;
+	// The rows that changed since this player was last sent them.
+	bool dirty[RACE_MAX_PLAYERS];
+	int dirtyCount;
+};
+
+// The coordinator's players and their rows, by id.
+static struct RacePlayer racePlayers[RACE_MAX_PLAYERS];
+static struct RaceRow hostRows[RACE_MAX_PLAYERS];
+static int hostPlayers;
+static long long raceStartNanos;
+static long long updatesReceived;
+static long long rowsSent;
+static struct Histogram fanOutTime;
+
+// A player's side of the race. The table is updated by whichever
+// thread calls RaceReceive() and read by whichever draws it.
+static int raceSocket = -1;
+// As much as the coordinator sends a player at once.
+static char raceInput[RACE_OUTPUT_LENGTH];
+static int raceInputLength;
+static struct RaceRow clientRows[RACE_MAX_PLAYERS];
+static int clientPlayers;
+static pthread_mutex_t tableMutex = PTHREAD_MUTEX_INITIALIZER;
+static int lastUncovered = -1;
+static char lastState;
+
+static int CompareRows(const void *a, const void *b)
+{
+	// Winners first, fastest first. Everyone else by how much they've
+	// uncovered, and then by who got there first.
+	const struct RaceRow *left = a;
+	const struct RaceRow *right = b;
+
+	if ((left->state == 'W') != (right->state == 'W'))
+	{
+		return left->state == 'W' ? -1 : 1;
+	}
+
+	if (left->state != 'W' && left->uncovered != right->uncovered)
+	{
+		return right->uncovered - left->uncovered;
+	}
+
+	return left->ms - right->ms;
+}
+
+static bool SplitLines(char *input, int *length, void (*handle)(int, char *), int who)
+{
+	// Hand each whole line to handle. Returns false if a line is too long.
+	char *start = input;
+	char *end = input + *length;
+	char *newline;
+
+	while ((newline = memchr(start, '\n', end - start)) != NULL)
+	{
+		*newline = '\0';
+		handle(who, start);
+		start = newline + 1;
+	}
+
+	*length = end - start;
+	memmove(input, start, *length);
+
+	return *length < RACE_LINE_LENGTH;
+}
+
+static void Changed(int id)
+{
+	// Every connected player needs to hear about the row.
+	for (int i = 0; i < hostPlayers; i++)
+	{
+		if (racePlayers[i].fd >= 0 && !racePlayers[i].dirty[id])
+		{
+			racePlayers[i].dirty[id] = true;
+			racePlayers[i].dirtyCount++;
+		}
+	}
+}
+
+static void Drop(int id)
+{
+	// A player who leaves before finishing has lost.
+	close(racePlayers[id].fd);
+	racePlayers[id].fd = -1;
+
+	if (hostRows[id].state == 'P')
+	{
+		hostRows[id].state = 'L';
+		hostRows[id].ms = (MonotonicNanos() - raceStartNanos) / 1000000;
+		Changed(id);
+	}
+}
+
+static void Pump(int id)
+{
+	// Send what this player is owed without waiting. Rows are only
+	// written out once the last lot has gone, so a player who's behind
+	// gets the latest of each row rather than every update in between.
+	struct RacePlayer *player = &racePlayers[id];
+
+	if (player->fd < 0)
+	{
+		return;
+	}
+
+	if (player->outputSent == player->outputLength && player->dirtyCount > 0)
+	{
+		player->outputSent = 0;
+		player->outputLength = 0;
+
+		for (int i = 0; i < hostPlayers; i++)
+		{
+			if (player->dirty[i])
+			{
+				player->dirty[i] = false;
+				player->outputLength += sprintf(player->output + player->outputLength, "U %d %d %c %d\n", i,
+												hostRows[i].uncovered, hostRows[i].state, hostRows[i].ms);
+				rowsSent++;
+			}
+		}
+
+		player->dirtyCount = 0;
+	}
+
+	while (player->outputSent < player->outputLength)
+	{
+		ssize_t sent = send(player->fd, player->output + player->outputSent,
+							player->outputLength - player->outputSent, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (sent < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				Drop(id);
+			}
+
+			return;
+		}
+
+		player->outputSent += sent;
+	}
+}
+
+static void HandleJoin(int id, char *line)
+{
+	// Before the start, all a player can do is give their name.
+	struct RacePlayer *player = &racePlayers[id];
+
+	if (line[0] == 'J' && line[1] == ' ' && !player->joined)
+	{
+		// Names are a single word, cut down to fit.
+		char *name = hostRows[id].name;
+
+		snprintf(name, RACE_NAME_LENGTH, "%s", line + 2);
+		name[strcspn(name, " \t")] = '\0';
+
+		if (name[0] == '\0')
+		{
+			sprintf(name, "player%d", (id + 1) % 100);
+		}
+
+		player->joined = true;
+	}
+}
+
+static void HandleProgress(int id, char *line)
+{
+	int uncovered;
+	char state;
+
+	if (hostRows[id].state != 'P' || sscanf(line, "P %d %c", &uncovered, &state) != 2 ||
+		(state != 'P' && state != 'W' && state != 'L'))
+	{
+		return;
+	}
+
+	updatesReceived++;
+
+	hostRows[id].uncovered = uncovered;
+	hostRows[id].state = state;
+	hostRows[id].ms = (MonotonicNanos() - raceStartNanos) / 1000000;
+	Changed(id);
+}
+
+static bool ReadPlayer(int id, void (*handle)(int, char *))
+{
+	// Take in whatever the player has sent. Returns false if they've gone.
+	struct RacePlayer *player = &racePlayers[id];
+	ssize_t count = read(player->fd, player->input + player->inputLength,
+						 sizeof(player->input) - player->inputLength);
+
+	if (count <= 0)
+	{
+		return false;
+	}
+
+	player->inputLength += count;
+	return SplitLines(player->input, &player->inputLength, handle, id);
+}
+
+static int ListenForRace(const char *path)
+{
+	struct sockaddr_un address;
+	int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (listener < 0 || strlen(path) >= sizeof(address.sun_path))
+	{
+		fprintf(stderr, "Can't hold a race on %s\n", path);
+		exit(EXIT_FAILURE);
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	unlink(path);
+
+	if (bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+		listen(listener, RACE_MAX_PLAYERS) != 0)
+	{
+		perror("Can't hold a race");
+		exit(EXIT_FAILURE);
+	}
+
+	return listener;
+}
+
+static void WaitForPlayers(int listener)
+{
+	// Take players until there's one in every place and they've all
+	// given their names.
+	struct pollfd polls[RACE_MAX_PLAYERS + 1];
+	int joined = 0;
+
+	for (int i = 0; i < hostPlayers; i++)
+	{
+		racePlayers[i].fd = -1;
+	}
+
+	while (joined < hostPlayers)
+	{
+		polls[0].fd = listener;
+		polls[0].events = POLLIN;
+
+		for (int i = 0; i < hostPlayers; i++)
+		{
+			polls[i + 1].fd = racePlayers[i].fd;
+			polls[i + 1].events = POLLIN;
+		}
+
+		if (poll(polls, hostPlayers + 1, -1) < 0 && errno != EINTR)
+		{
+			perror("poll");
+			exit(EXIT_FAILURE);
+		}
+
+		for (int i = 0; i < hostPlayers; i++)
+		{
+			if (racePlayers[i].fd >= 0 && polls[i + 1].revents != 0 && !ReadPlayer(i, HandleJoin))
+			{
+				close(racePlayers[i].fd);
+				memset(&racePlayers[i], 0, sizeof(racePlayers[i]));
+				racePlayers[i].fd = -1;
+			}
+		}
+
+		if (polls[0].revents & POLLIN)
+		{
+			int client = accept(listener, NULL, NULL);
+			int id = 0;
+
+			while (id < hostPlayers && racePlayers[id].fd >= 0)
+			{
+				id++;
+			}
+
+			if (client >= 0 && id < hostPlayers)
+			{
+				racePlayers[id].fd = client;
+				printf("A player has arrived\n");
+			}
+			else if (client >= 0)
+			{
+				close(client);
+			}
+		}
+
+		joined = 0;
+
+		for (int i = 0; i < hostPlayers; i++)
+		{
+			joined += racePlayers[i].fd >= 0 && racePlayers[i].joined;
+		}
+	}
+}
+
+void RaceHost(const char *path, int players, int difficulty, int safeTiles)
+{
+	struct pollfd polls[RACE_MAX_PLAYERS];
+	int listener = ListenForRace(path);
+	unsigned seed = (unsigned) time(NULL) ^ (unsigned) MonotonicNanos();
+
+	if (players < 1 || players > RACE_MAX_PLAYERS)
+	{
+		fprintf(stderr, "A race is for 1 to %d players\n", RACE_MAX_PLAYERS);
+		exit(EXIT_FAILURE);
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	hostPlayers = players;
+
+	printf("Waiting on %s for %d players\n", path, players);
+	fflush(stdout);
+
+	WaitForPlayers(listener);
+
+	close(listener);
+	unlink(path);
+
+	// Everyone gets the names, then the board, as close together as
+	// the sends allow.
+	char names[RACE_MAX_PLAYERS * (RACE_NAME_LENGTH + 16)];
+	int namesLength = 0;
+
+	for (int i = 0; i < players; i++)
+	{
+		hostRows[i].id = i;
+		hostRows[i].state = 'P';
+		namesLength += sprintf(names + namesLength, "J %d %s\n", i, hostRows[i].name);
+	}
+
+	raceStartNanos = MonotonicNanos();
+
+	for (int i = 0; i < players; i++)
+	{
+		char start[64];
+		int length = sprintf(start, "G %d %d %u %d\n", i, players, seed, difficulty);
+
+		if (send(racePlayers[i].fd, names, namesLength, MSG_NOSIGNAL) != namesLength ||
+			send(racePlayers[i].fd, start, length, MSG_NOSIGNAL) != length)
+		{
+			Drop(i);
+		}
+	}
+
+	printf("The race is on, with seed %u\n", seed);
+	fflush(stdout);
+
+	// Run the race until everyone has finished and been told so.
+	while (true)
+	{
+		bool running = false;
+
+		for (int i = 0; i < players; i++)
+		{
+			struct RacePlayer *player = &racePlayers[i];
+
+			polls[i].fd = player->fd;
+			polls[i].events = POLLIN;
+
+			if (player->fd >= 0 && (player->outputSent < player->outputLength || player->dirtyCount > 0))
+			{
+				polls[i].events |= POLLOUT;
+				running = true;
+			}
+
+			running = running || (player->fd >= 0 && hostRows[i].state == 'P');
+		}
+
+		if (!running)
+		{
+			break;
+		}
+
+		if (poll(polls, players, -1) < 0 && errno != EINTR)
+		{
+			perror("poll");
+			break;
+		}
+
+		bool changed = false;
+		long long readNanos = MonotonicNanos();
+
+		for (int i = 0; i < players; i++)
+		{
+			if (polls[i].fd < 0 || racePlayers[i].fd < 0)
+			{
+				continue;
+			}
+
+			if (polls[i].revents & (POLLIN | POLLHUP | POLLERR))
+			{
+				if (!ReadPlayer(i, HandleProgress))
+				{
+					Drop(i);
+				}
+
+				changed = true;
+			}
+		}
+
+		// Send every player what changed straight away, and time how long
+		// it took to get it to all of them.
+		for (int i = 0; i < players; i++)
+		{
+			Pump(i);
+		}
+
+		if (changed)
+		{
+			HistogramRecord(&fanOutTime, MonotonicNanos() - readNanos);
+		}
+	}
+
+	// The final standings.
+	struct RaceRow ranking[RACE_MAX_PLAYERS];
+
+	memcpy(ranking, hostRows, sizeof(ranking[0]) * players);
+	qsort(ranking, players, sizeof(ranking[0]), CompareRows);
+
+	for (int i = 0; i < players; i++)
+	{
+		printf("%2d. %-*s %3d%% %s %.3f s\n", i + 1, RACE_NAME_LENGTH, ranking[i].name,
+			   ranking[i].uncovered * 100 / safeTiles, ranking[i].state == 'W' ? "won " : "lost",
+			   ranking[i].ms / 1000.0);
+	}
+
+	printf("%lld updates from players, %lld rows sent to them\n", updatesReceived, rowsSent);
+	HistogramPrint(stdout, "fan-out", &fanOutTime, 1000.0, "us");
+
+	for (int i = 0; i < players; i++)
+	{
+		if (racePlayers[i].fd >= 0)
+		{
+			close(racePlayers[i].fd);
+		}
+	}
+}
+
+static bool ReadRaceLine(char *line)
+{
+	// Wait for the next line from the coordinator. Only a full buffer
+	// with no line in it at all is too much.
+	char *newline;
+
+	while ((newline = memchr(raceInput, '\n', raceInputLength)) == NULL)
+	{
+		if (raceInputLength == (int) sizeof(raceInput))
+		{
+			return false;
+		}
+
+		ssize_t count = read(raceSocket, raceInput + raceInputLength, sizeof(raceInput) - raceInputLength);
+
+		if (count <= 0)
+		{
+			return false;
+		}
+
+		raceInputLength += count;
+	}
+
+	int length = newline - raceInput;
+
+	if (length >= RACE_LINE_LENGTH)
+	{
+		return false;
+	}
+
+	memcpy(line, raceInput, length);
+	line[length] = '\0';
+	raceInputLength -= length + 1;
+	memmove(raceInput, newline + 1, raceInputLength);
+
+	return true;
+}
+
+static bool SendRace(const char *text, int length)
+{
+	while (length > 0)
+	{
+		ssize_t sent = send(raceSocket, text, length, MSG_NOSIGNAL);
+
+		if (sent <= 0)
+		{
+			return false;
+		}
+
+		text += sent;
+		length -= sent;
+	}
+
+	return true;
+}
+
+bool RaceJoin(const char *path, const char *name, struct RaceStart *start)
+{
+	struct sockaddr_un address;
+	char line[RACE_LINE_LENGTH];
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	raceSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (raceSocket < 0 || connect(raceSocket, (struct sockaddr *) &address, sizeof(address)) != 0)
+	{
+		RaceClose();
+		return false;
+	}
+
+	// The coordinator keeps no more of a name than fits in a row.
+	if (!SendRace(line, snprintf(line, sizeof(line), "J %.*s\n", RACE_NAME_LENGTH - 1, name)))
+	{
+		RaceClose();
+		return false;
+	}
+
+	while (ReadRaceLine(line))
+	{
+		int id;
+		char playerName[RACE_NAME_LENGTH];
+
+		if (sscanf(line, "J %d %15s", &id, playerName) == 2 && id >= 0 && id < RACE_MAX_PLAYERS)
+		{
+			clientRows[id].id = id;
+			clientRows[id].state = 'P';
+			strcpy(clientRows[id].name, playerName);
+		}
+		else if (sscanf(line, "G %d %d %u %d", &start->id, &start->players, &start->seed, &start->difficulty) == 4 &&
+				 start->players >= 1 && start->players <= RACE_MAX_PLAYERS)
+		{
+			clientPlayers = start->players;
+			return true;
+		}
+	}
+
+	RaceClose();
+	return false;
+}
+
+void RaceReport(int uncovered, char state)
+{
+	// Only say anything when something has changed.
+	char line[64];
+
+	if (raceSocket < 0 || (uncovered == lastUncovered && state == lastState))
+	{
+		return;
+	}
+
+	lastUncovered = uncovered;
+	lastState = state;
+
+	SendRace(line, sprintf(line, "P %d %c\n", uncovered, state));
+}
+
+bool RaceReceive()
+{
+	// Apply every whole update that's come in, once at least one has.
+	char line[RACE_LINE_LENGTH];
+
+	if (!ReadRaceLine(line))
+	{
+		return false;
+	}
+
+	do
+	{
+		struct RaceRow row;
+
+		if (sscanf(line, "U %d %d %c %d", &row.id, &row.uncovered, &row.state, &row.ms) == 4 && row.id >= 0 &&
+			row.id < clientPlayers)
+		{
+			pthread_mutex_lock(&tableMutex);
+			clientRows[row.id].uncovered = row.uncovered;
+			clientRows[row.id].state = row.state;
+			clientRows[row.id].ms = row.ms;
+			pthread_mutex_unlock(&tableMutex);
+		}
+	} while (memchr(raceInput, '\n', raceInputLength) != NULL && ReadRaceLine(line));
+
+	return true;
+}
+
+int RaceRanking(struct RaceRow *rows)
+{
+	pthread_mutex_lock(&tableMutex);
+	memcpy(rows, clientRows, sizeof(rows[0]) * clientPlayers);
+	pthread_mutex_unlock(&tableMutex);
+
+	qsort(rows, clientPlayers, sizeof(rows[0]), CompareRows);
+	return clientPlayers;
+}
+
+void RaceLeave()
+{
+	// Wakes up RaceReceive(), which then returns false.
+	if (raceSocket >= 0)
+	{
+		shutdown(raceSocket, SHUT_RDWR);
+	}
+}
+
+void RaceClose()
+{
+	if (raceSocket >= 0)
+	{
+		close(raceSocket);
+		raceSocket = -1;
+	}
+}
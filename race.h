@@ -0,0 +1,69 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - same seed races
+
+#ifndef RACE_H
+#define RACE_H
+
+#include <stdbool.h>
+
+// A race is any number of players on one host playing the same board
+// at the same time, each in their own terminal, with a coordinator
+// keeping the ranking. Everything goes over a UNIX socket as lines of
+// text.
+//
+// A player joins with "J name" and waits. Once everyone has joined, the
+// coordinator sends each of them "J id name" for every player and then
+// "G id players seed difficulty", giving them their own id and the
+// board to deal, and the race is on. Players send "P uncovered state"
+// as they go, with how many safe tiles they have uncovered and P, W or
+// L, and the coordinator answers everyone with "U id uncovered state ms",
+// timed from the start by its own clock.
+//
+// Nobody is sent anything but the rows that changed. A player who falls
+// behind reading only ever gets the latest row for each of the others,
+// however many updates came in meanwhile.
+
+#define RACE_MAX_PLAYERS 64
+#define RACE_NAME_LENGTH 16
+#define RACE_LINE_LENGTH 256
+
+// Where one player stands. A player who leaves before finishing is
+// counted as having lost.
+struct RaceRow {
+	int id;
+	char name[RACE_NAME_LENGTH];
+	int uncovered;
+	char state;
+	int ms;
+};
+
+struct RaceStart {
+	int id;
+	int players;
+	unsigned seed;
+	int difficulty;
+};
+
+// Run the coordinator for a race between the given number of players
+// until every one of them has finished, then print the final ranking
+// and how long broadcasting the updates took. safeTiles is only used
+// to show progress as a percentage.
+void RaceHost(const char *path, int players, int difficulty, int safeTiles);
+
+// Join a race and wait for it to start. Returns false if there's no
+// race to join. The coordinator cuts name down to a single word.
+bool RaceJoin(const char *path, const char *name, struct RaceStart *start);
+void RaceReport(int uncovered, char state);
+// Wait for the next updates from the coordinator and apply them.
+// Returns false once the coordinator has gone or RaceLeave() is called.
+bool RaceReceive();
+// Copy out the players best first, and return how many there are.
+int RaceRanking(struct RaceRow *rows);
+// Make RaceReceive() return, from another thread, then close the
+// connection once it has.
+void RaceLeave();
+void RaceClose();
+
+#endif
@@ -0,0 +1,194 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - replay encoding
+
+#include <stdio.h>
+#include <string.h>
+
+#include "replay.h"
+
+static bool PutVarint(struct Replay *replay, unsigned long long value)
+{
+	// Seven bits per byte, low bits first, with the top bit set on
+	// every byte but the last.
+	do
+	{
+		if (replay->length == REPLAY_LENGTH)
+		{
+			return false;
+		}
+
+		unsigned char byte = value & 0x7f;
+		value >>= 7;
+
+		replay->data[replay->length++] = value != 0 ? byte | 0x80 : byte;
+	} while (value != 0);
+
+	return true;
+}
+
+void ReplayReset(struct Replay *replay, unsigned seed, int mines, int cols)
+{
+	replay->seed = seed;
+	replay->mines = mines;
+	replay->cols = cols;
+	replay->moves = 0;
+	replay->length = 0;
+	replay->full = false;
+	replay->lastMs = 0;
+	replay->lastTile = 0;
+}
+
+bool ReplayAppend(struct Replay *replay, const struct ReplayMove *move)
+{
+	// Store the move relative to the one before it. The tile offset
+	// can be negative, so it's zigzag encoded to keep it small, and
+	// the action goes in its lowest bit.
+	if (replay->full)
+	{
+		return false;
+	}
+
+	int tile = move->row * replay->cols + move->col;
+	long long offset = tile - replay->lastTile;
+	unsigned long long zigzag = offset >= 0 ? (unsigned long long) offset << 1 : ((unsigned long long) -offset << 1) - 1;
+	int length = replay->length;
+
+	if (!PutVarint(replay, move->ms - replay->lastMs) || !PutVarint(replay, zigzag << 1 | move->action))
+	{
+		// Leave out the partial move, so what's there still decodes.
+		replay->length = length;
+		replay->full = true;
+		return false;
+	}
+
+	replay->lastMs = move->ms;
+	replay->lastTile = tile;
+	replay->moves++;
+
+	return true;
+}
+
+void ReplayDecoderReset(struct ReplayDecoder *decoder, int rows, int cols)
+{
+	memset(decoder, 0, sizeof(*decoder));
+	decoder->rows = rows;
+	decoder->cols = cols;
+}
+
+bool ReplayDecode(struct ReplayDecoder *decoder, unsigned char byte, struct ReplayMove *move)
+{
+	// Ten bytes is all a 64 bit varint can take, so anything longer
+	// can't have come from ReplayAppend().
+	if (decoder->corrupt || decoder->shift >= 70)
+	{
+		decoder->corrupt = true;
+		return false;
+	}
+
+	decoder->value |= (unsigned long long) (byte & 0x7f) << decoder->shift;
+	decoder->shift += 7;
+
+	if (byte & 0x80)
+	{
+		return false;
+	}
+
+	unsigned long long value = decoder->value;
+
+	decoder->value = 0;
+	decoder->shift = 0;
+
+	// The first varint of a move is its time, the second its tile.
+	if (!decoder->haveTime)
+	{
+		decoder->ms = decoder->lastMs + value;
+		decoder->haveTime = true;
+		return false;
+	}
+
+	unsigned long long zigzag = value >> 1;
+	long long offset = zigzag & 1 ? -(long long) ((zigzag + 1) >> 1) : (long long) (zigzag >> 1);
+	long long tile = decoder->lastTile + offset;
+
+	if (tile < 0 || tile >= (long long) decoder->rows * decoder->cols)
+	{
+		decoder->corrupt = true;
+		return false;
+	}
+
+	move->ms = decoder->ms;
+	move->action = value & 1;
+	move->row = tile / decoder->cols;
+	move->col = tile % decoder->cols;
+
+	decoder->lastMs = decoder->ms;
+	decoder->lastTile = tile;
+	decoder->haveTime = false;
+
+	return true;
+}
+
+int ReplayToText(const struct Replay *replay, char *text, int size)
+{
+	static const char digits[] = "0123456789abcdef";
+	int length = snprintf(text, size, "%u %d %d %d %d %lld %d ", replay->seed, replay->mines, replay->cols,
+						  replay->moves, replay->lastTile, replay->lastMs, replay->length);
+
+	for (int i = 0; i < replay->length && length + 2 < size; i++)
+	{
+		text[length++] = digits[replay->data[i] >> 4];
+		text[length++] = digits[replay->data[i] & 0xf];
+	}
+
+	text[length] = '\0';
+	return length;
+}
+
+static int HexValue(char digit)
+{
+	if (digit >= '0' && digit <= '9')
+	{
+		return digit - '0';
+	}
+
+	if (digit >= 'a' && digit <= 'f')
+	{
+		return digit - 'a' + 10;
+	}
+
+	return -1;
+}
+
+bool ReplayFromText(struct Replay *replay, const char *text, const char **end)
+{
+	int consumed = 0;
+
+	if (sscanf(text, "%u %d %d %d %d %lld %d %n", &replay->seed, &replay->mines, &replay->cols, &replay->moves,
+			   &replay->lastTile, &replay->lastMs, &replay->length, &consumed) != 7 || consumed == 0 ||
+		replay->length < 0 || replay->length > REPLAY_LENGTH || replay->cols < 1)
+	{
+		return false;
+	}
+
+	text += consumed;
+
+	for (int i = 0; i < replay->length; i++)
+	{
+		int high = HexValue(text[0]);
+		int low = high >= 0 ? HexValue(text[1]) : -1;
+
+		if (low < 0)
+		{
+			return false;
+		}
+
+		replay->data[i] = high << 4 | low;
+		text += 2;
+	}
+
+	replay->full = false;
+	*end = text;
+	return true;
+}
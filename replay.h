@@ -0,0 +1,74 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - replay encoding
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdbool.h>
+
+// A replay is the seed the board was dealt from and every reveal and
+// flag made on it. Each move is packed into a few bytes: the time since
+// the previous move, then the action and how far the tile is from the
+// previous move's tile, both as varints. Moves are mostly close together
+// in time and space, so a whole game usually fits in a few hundred bytes.
+#define REPLAY_LENGTH 2048
+
+enum ReplayAction {
+	REPLAY_REVEAL,
+	REPLAY_FLAG
+};
+
+struct ReplayMove {
+	long long ms;
+	enum ReplayAction action;
+	int row;
+	int col;
+};
+
+struct Replay {
+	unsigned seed;
+	int mines;
+	int cols;
+	int moves;
+	int length;
+	bool full;
+	long long lastMs;
+	int lastTile;
+	unsigned char data[REPLAY_LENGTH];
+};
+
+// Decodes a replay a byte at a time, so it can be fed straight from
+// whatever chunks the data is read in. corrupt is set, and every byte
+// after ignored, once the data turns out not to be a replay of a rows
+// by cols board.
+struct ReplayDecoder {
+	int rows;
+	int cols;
+	bool corrupt;
+	long long lastMs;
+	int lastTile;
+	unsigned long long value;
+	int shift;
+	bool haveTime;
+	long long ms;
+};
+
+void ReplayReset(struct Replay *replay, unsigned seed, int mines, int cols);
+// Returns false, and marks the replay full, once a move doesn't fit.
+bool ReplayAppend(struct Replay *replay, const struct ReplayMove *move);
+
+// A replay as one line of text, for sending it over a socket: its
+// header fields, then its data in hex. ReplayFromText() returns false
+// if the text isn't a replay, and sets end to just after it.
+#define REPLAY_TEXT_LENGTH (2 * REPLAY_LENGTH + 80)
+
+int ReplayToText(const struct Replay *replay, char *text, int size);
+bool ReplayFromText(struct Replay *replay, const char *text, const char **end);
+
+void ReplayDecoderReset(struct ReplayDecoder *decoder, int rows, int cols);
+// Returns true when byte completes a move, which is stored in move.
+bool ReplayDecode(struct ReplayDecoder *decoder, unsigned char byte, struct ReplayMove *move);
+
+#endif
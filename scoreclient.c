@@ -0,0 +1,252 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - high score daemon client
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "scoreclient.h"
+
+// A daemon that takes longer than this to answer is treated as gone.
+#define SCORE_CLIENT_TIMEOUT_MS 1000
+
+static int daemonSocket = -1;
+static char input[SCORE_DAEMON_LINE_LENGTH];
+static int inputStart;
+static int inputEnd;
+
+bool ScoreClientConnect(const char *path)
+{
+	struct sockaddr_un address;
+	struct timeval timeout = { SCORE_CLIENT_TIMEOUT_MS / 1000, (SCORE_CLIENT_TIMEOUT_MS % 1000) * 1000 };
+
+	if (daemonSocket >= 0)
+	{
+		return true;
+	}
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	daemonSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+
+	if (daemonSocket < 0)
+	{
+		return false;
+	}
+
+	setsockopt(daemonSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(daemonSocket, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	if (connect(daemonSocket, (struct sockaddr *) &address, sizeof(address)) != 0)
+	{
+		ScoreClientClose();
+		return false;
+	}
+
+	inputStart = 0;
+	inputEnd = 0;
+	return true;
+}
+
+void ScoreClientClose()
+{
+	if (daemonSocket >= 0)
+	{
+		close(daemonSocket);
+		daemonSocket = -1;
+	}
+}
+
+bool ScoreClientConnected()
+{
+	return daemonSocket >= 0;
+}
+
+static bool Send(const char *request, int length)
+{
+	while (length > 0)
+	{
+		ssize_t sent = send(daemonSocket, request, length, MSG_NOSIGNAL);
+
+		if (sent <= 0)
+		{
+			return false;
+		}
+
+		request += sent;
+		length -= sent;
+	}
+
+	return true;
+}
+
+static char *ReadLine()
+{
+	// Return the next line from the daemon without its newline, or
+	// NULL if there isn't a whole one before the timeout.
+	while (true)
+	{
+		char *newline = memchr(input + inputStart, '\n', inputEnd - inputStart);
+
+		if (newline != NULL)
+		{
+			char *line = input + inputStart;
+
+			*newline = '\0';
+			inputStart = newline + 1 - input;
+			return line;
+		}
+
+		if (inputStart > 0)
+		{
+			memmove(input, input + inputStart, inputEnd - inputStart);
+			inputEnd -= inputStart;
+			inputStart = 0;
+		}
+
+		if (inputEnd == sizeof(input))
+		{
+			return NULL;
+		}
+
+		ssize_t count = recv(daemonSocket, input + inputEnd, sizeof(input) - inputEnd, 0);
+
+		if (count <= 0)
+		{
+			return NULL;
+		}
+
+		inputEnd += count;
+	}
+}
+
+static char *Request(const char *request, int length)
+{
+	// Send a request and wait for the first line of the reply. Give up
+	// on the daemon for good if that goes wrong or it reports an error.
+	char *reply = NULL;
+
+	if (daemonSocket >= 0 && Send(request, length))
+	{
+		reply = ReadLine();
+	}
+
+	if (reply == NULL || strncmp(reply, "ERR", 3) == 0)
+	{
+		ScoreClientClose();
+		return NULL;
+	}
+
+	return reply;
+}
+
+bool ScoreClientPlace(int difficulty, int scoreMs, int places, struct Placing *placing)
+{
+	char request[64];
+	int length = snprintf(request, sizeof(request), "PLACE %d %d %d\n", difficulty, scoreMs, places);
+	char *reply = Request(request, length);
+	int qualifies;
+
+	if (reply == NULL || sscanf(reply, "%d %d", &qualifies, &placing->rank) != 2)
+	{
+		ScoreClientClose();
+		return false;
+	}
+
+	placing->qualifies = qualifies;
+	return true;
+}
+
+bool ScoreClientTop(int difficulty, int limit, void (*row)(const char *name, int scoreMs))
+{
+	// Read the whole reply before handing any of it to row(), so that
+	// if the daemon goes away part way, the caller can start again
+	// from the database without showing anything twice.
+	struct {
+		int scoreMs;
+		char name[SCORE_NAME_LENGTH];
+	} rows[SCORE_DAEMON_TOP_LIMIT];
+	char request[64];
+	int count;
+
+	if (limit > SCORE_DAEMON_TOP_LIMIT)
+	{
+		return false;
+	}
+
+	int length = snprintf(request, sizeof(request), "TOP %d %d\n", difficulty, limit);
+	char *reply = Request(request, length);
+
+	if (reply == NULL || sscanf(reply, "%d", &count) != 1 || count < 0 || count > limit)
+	{
+		ScoreClientClose();
+		return false;
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		char *line = ReadLine();
+		char *name = line != NULL ? strchr(line, ' ') : NULL;
+
+		if (name == NULL)
+		{
+			ScoreClientClose();
+			return false;
+		}
+
+		rows[i].scoreMs = atoi(line);
+		snprintf(rows[i].name, sizeof(rows[i].name), "%s", name + 1);
+	}
+
+	for (int i = 0; i < count; i++)
+	{
+		row(rows[i].name, rows[i].scoreMs);
+	}
+
+	return true;
+}
+
+bool ScoreClientSave(const char *name, int difficulty, int rows, int cols, int score, int scoreMs, int places,
+					 const struct Replay *replay, int durationMs)
+{
+	// The name ends the line, so it can't have a line break in it.
+	char request[SCORE_DAEMON_LINE_LENGTH];
+	int length = snprintf(request, sizeof(request), "SAVE %d %d %d %d %d %d %d ",
+						  difficulty, rows, cols, score, scoreMs, places, durationMs);
+
+	if (replay != NULL)
+	{
+		length += ReplayToText(replay, request + length, sizeof(request) - length);
+	}
+	else
+	{
+		request[length++] = '-';
+	}
+
+	length += snprintf(request + length, sizeof(request) - length, " %s\n", name);
+
+	for (int i = length - (int) strlen(name) - 1; i < length - 1; i++)
+	{
+		if (request[i] == '\n' || request[i] == '\r')
+		{
+			request[i] = ' ';
+		}
+	}
+
+	char *reply = Request(request, length);
+
+	return reply != NULL && strcmp(reply, "OK") == 0;
+}
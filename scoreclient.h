@@ -0,0 +1,40 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - high score daemon client
+
+#ifndef SCORECLIENT_H
+#define SCORECLIENT_H
+
+#include <stdbool.h>
+
+#include "replay.h"
+#include "scorestore.h"
+
+// minesweeperd keeps the high score tables in memory and answers for
+// them over a UNIX domain socket, one line per request:
+//
+//   TOP difficulty limit          ->  count, then count lines of "scoreMs name"
+//   PLACE difficulty scoreMs places  ->  "qualifies rank"
+//   SAVE difficulty rows cols score scoreMs places durationMs replay|- name
+//                                 ->  "OK", once the score is committed
+//
+// Anything else gets "ERR message". The replay is in the form written
+// by ReplayToText(), and the name runs to the end of the line.
+#define SCORE_DAEMON_SOCKET "scores.sock"
+#define SCORE_DAEMON_LINE_LENGTH (REPLAY_TEXT_LENGTH + SCORE_NAME_LENGTH + 128)
+#define SCORE_DAEMON_TOP_LIMIT 64
+
+// Every call returns false if the daemon isn't there or stops answering,
+// after which the client stays disconnected and the caller should go
+// to the database itself.
+bool ScoreClientConnect(const char *path);
+void ScoreClientClose();
+bool ScoreClientConnected();
+
+bool ScoreClientPlace(int difficulty, int scoreMs, int places, struct Placing *placing);
+bool ScoreClientTop(int difficulty, int limit, void (*row)(const char *name, int scoreMs));
+bool ScoreClientSave(const char *name, int difficulty, int rows, int cols, int score, int scoreMs, int places,
+					 const struct Replay *replay, int durationMs);
+
+#endif
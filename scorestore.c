@@ -0,0 +1,1622 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - high score storage
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <sqlite3.h>
+
+#include "stats.h"
+#include "scorestore.h"
+#include "scoreclient.h"
+
+// Each schema change bumps the version kept in the
+// database's user_version, so it's only applied once.
+#define SCHEMA_VERSION 7
+
+// How many scores and games can be waiting on the writer thread at once.
+#define WRITE_QUEUE_SIZE 32
+
+// Other players' games write to the same database. SQLite waits this
+// long for their locks itself, and after that a transaction is retried
+// this many times, sleeping twice as long (plus some jitter) each time.
+#define BUSY_TIMEOUT_MS 1000
+#define BUSY_RETRIES 8
+#define BUSY_BACKOFF_US 10000
+
+// Read-only connections map up to this much of the database
+// into memory instead of copying pages through read().
+#define READ_ONLY_MMAP_SIZE (64 * 1024 * 1024)
+
+// Imports commit every this many rows. A row of the export format
+// never needs more than this many characters, names quoted and all.
+#define IMPORT_BATCH_ROWS 10000
+#define CSV_LINE_LENGTH 1024
+#define CSV_FIELDS 13
+
+// Replays are read through an incremental blob handle this much at a time.
+#define REPLAY_CHUNK 256
+
+// Every statement the store uses, prepared once per connection.
+enum Statement {
+	CUTOFF,
+	RANK,
+	PRUNE,
+	INSERT,
+	IMPORT_SCORE,
+	SCORE_KEPT,
+	TOP,
+	INSERT_GAME,
+	IMPORT_GAME,
+	ADD_GAME_STATS,
+	UPDATE_GAME_STATS,
+	GAME_STATS,
+	EXPORT_SCORES,
+	EXPORT_GAMES,
+	INSERT_REPLAY,
+	LIST_REPLAYS,
+	REPLAY_INFO,
+	DATA_VERSION,
+	BEGIN,
+	COMMIT,
+	ROLLBACK,
+	STATEMENT_COUNT
+};
+
+static const char *statementSql[STATEMENT_COUNT] = {
+	[CUTOFF] = "select score_ms from scores where difficulty = ? order by score_ms desc limit 1 offset ?",
+	[RANK] = "select count(*) from scores where difficulty = ? and score_ms > ?",
+	[PRUNE] = "delete from scores where id in (select id from scores where difficulty = ?"
+			  " order by score_ms desc limit -1 offset ?)",
+	[INSERT] = "insert into scores(name, difficulty, rows, cols, score, score_ms) values(?, ?, ?, ?, ?, ?)",
+	[IMPORT_SCORE] = "insert or ignore into scores(name, difficulty, rows, cols, score, score_ms, origin)"
+					 " values(?, ?, ?, ?, ?, ?, ?)",
+	[SCORE_KEPT] = "select count(*) from scores where id = ?",
+	[TOP] = "select name, score_ms from scores where difficulty = ? order by score_ms desc limit ?",
+	[INSERT_GAME] = "insert into games(seed, difficulty, rows, cols, mines, won, duration_ms,"
+					" three_bv, clicks, played_at)"
+					" values(?, ?, ?, ?, ?, ?, ?, ?, ?, coalesce(nullif(?, 0), strftime('%s', 'now')))",
+	[IMPORT_GAME] = "insert or ignore into games(seed, difficulty, rows, cols, mines, won, duration_ms,"
+					" three_bv, clicks, played_at, origin)"
+					" values(?, ?, ?, ?, ?, ?, ?, ?, ?, coalesce(nullif(?, 0), strftime('%s', 'now')), ?)",
+	[ADD_GAME_STATS] = "insert or ignore into game_stats(difficulty) values(?)",
+	[UPDATE_GAME_STATS] = "update game_stats set games = games + 1, wins = wins + ?2,"
+						  " best_ms = case when ?2 and (best_ms is null or ?3 < best_ms) then ?3 else best_ms end,"
+						  " total_3bv_per_s = total_3bv_per_s + ?4 where difficulty = ?1",
+	[GAME_STATS] = "select difficulty, games, wins, best_ms, total_3bv_per_s from game_stats order by difficulty",
+	[EXPORT_SCORES] = "select difficulty, rows, cols, score, score_ms, name, origin from scores order by id",
+	[EXPORT_GAMES] = "select seed, difficulty, rows, cols, mines, won, duration_ms, three_bv, clicks, played_at,"
+					 " origin from games order by id",
+	[INSERT_REPLAY] = "insert or replace into replays(score_id, difficulty, rows, cols, mines, seed, duration_ms, moves,"
+					  " size, data) values(?, ?, ?, ?, ?, ?, ?, ?, ?, ?)",
+	[LIST_REPLAYS] = "select replays.score_id, replays.difficulty, replays.duration_ms, replays.moves, replays.size,"
+					 " replays.seed, scores.name from replays join scores on scores.id = replays.score_id"
+					 " order by replays.difficulty, replays.duration_ms",
+	[REPLAY_INFO] = "select difficulty, duration_ms, moves, size, seed, rows, cols, mines from replays where score_id = ?",
+	[DATA_VERSION] = "pragma data_version",
+	[BEGIN] = "begin immediate",
+	[COMMIT] = "commit",
+	[ROLLBACK] = "rollback"
+};
+
+struct Connection {
+	sqlite3 *db;
+	sqlite3_stmt *statements[STATEMENT_COUNT];
+
+	// Set when a failed transaction had to be rolled back, since the
+	// rollback itself replaces SQLite's own error message.
+	char rollbackError[256];
+};
+
+enum WriteKind {
+	WRITE_SCORE,
+	WRITE_GAME
+};
+
+// A score or a finished game waiting for the writer thread.
+struct PendingWrite {
+	enum WriteKind kind;
+	char name[SCORE_NAME_LENGTH];
+	int difficulty;
+	int rows;
+	int cols;
+	int score;
+	int scoreMs;
+	int places;
+	bool hasReplay;
+	struct Replay replay;
+	int durationMs;
+	struct GameRecord game;
+	atomic_int *status;
+};
+
+// The game's queries go through reader, and the writer thread has
+// its own connection so a slow commit never holds up the game.
+static char *storePath;
+static struct Connection reader;
+static struct Connection writer;
+
+// ScoreStoreOpenAsync() opens the reader on a thread of its own, and
+// the first call that needs it waits for that to finish.
+static pthread_t openerThread;
+static bool openerRunning;
+static bool openDeferred;
+static int openResult = SQLITE_MISUSE;
+
+// Set by ScoreStoreUseDaemon(). The daemon is only tried once, so if
+// it isn't there, or stops answering, the database is used from then on.
+static char *daemonPath;
+static bool daemonTried;
+
+// The write queue, a ring buffer shared with the writer thread.
+static struct PendingWrite writeQueue[WRITE_QUEUE_SIZE];
+static int queueHead;
+static int queueLength;
+static bool writerRunning;
+static bool writerStopping;
+static pthread_t writerThread;
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queueNotEmpty = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queueNotFull = PTHREAD_COND_INITIALIZER;
+
+// How long each kind of operation takes, for -stats.
+static struct Histogram openTime;
+static struct Histogram placeTime;
+static struct Histogram insertTime;
+static struct Histogram topTime;
+static struct Histogram gameStatsTime;
+static struct Histogram batchTime;
+static struct Histogram batchSize;
+static struct Histogram busyRetries;
+static struct Histogram importBatchTime;
+static struct Histogram replayReadTime;
+
+static int SchemaVersion(sqlite3 *db)
+{
+	sqlite3_stmt *probe;
+	int version = 0;
+
+	if (sqlite3_prepare_v2(db, "pragma user_version", -1, &probe, NULL) == SQLITE_OK)
+	{
+		if (sqlite3_step(probe) == SQLITE_ROW)
+		{
+			version = sqlite3_column_int(probe, 0);
+		}
+
+		sqlite3_finalize(probe);
+	}
+
+	return version;
+}
+
+static int MigrateSteps(sqlite3 *db)
+{
+	sqlite3_stmt *probe;
+
+	// Create the scores schema if this is a new database.
+	int res = sqlite3_exec(db, "create table if not exists scores("
+							   "id integer primary key autoincrement unique,"
+							   "name varchar(30),"
+							   "score int,"
+							   "score_ms int,"
+							   "difficulty int,"
+							   "rows int,"
+							   "cols int);", NULL, NULL, NULL);
+
+	// Version 1: databases created before scores were kept with
+	// millisecond precision don't have the score_ms column. Add it
+	// and carry the old whole-second scores over.
+	if (res != SQLITE_OK)
+	{
+		return res;
+	}
+
+	if (sqlite3_prepare_v2(db, "select score_ms from scores", -1, &probe, NULL) == SQLITE_OK)
+	{
+		sqlite3_finalize(probe);
+	}
+	else
+	{
+		res = sqlite3_exec(db, "alter table scores add column score_ms int;"
+							   "update scores set score_ms = score * 1000;", NULL, NULL, NULL);
+	}
+
+	// Version 2 indexed the scores by score_ms alone. Version 4
+	// replaces that index with one per difficulty.
+
+	// Version 3: every finished game goes into games, and game_stats
+	// keeps running totals for each difficulty so the stats screen
+	// never has to read the whole history.
+	if (res == SQLITE_OK)
+	{
+		res = sqlite3_exec(db, "create table if not exists games("
+							   "id integer primary key,"
+							   "seed int,"
+							   "difficulty int,"
+							   "rows int,"
+							   "cols int,"
+							   "mines int,"
+							   "won int,"
+							   "duration_ms int,"
+							   "three_bv int,"
+							   "clicks int,"
+							   "played_at int default (strftime('%s', 'now')));"
+							   "create table if not exists game_stats("
+							   "difficulty int primary key,"
+							   "games int not null default 0,"
+							   "wins int not null default 0,"
+							   "best_ms int,"
+							   "total_3bv_per_s real not null default 0);", NULL, NULL, NULL);
+	}
+
+	// Version 4: each difficulty gets its own table. Scores saved before
+	// that have no difficulty, so each is given the easiest one that
+	// could have scored it; every board was 10x10 then.
+	if (res == SQLITE_OK && sqlite3_prepare_v2(db, "select difficulty from scores", -1, &probe, NULL) == SQLITE_OK)
+	{
+		sqlite3_finalize(probe);
+	}
+	else if (res == SQLITE_OK)
+	{
+		res = sqlite3_exec(db, "alter table scores add column difficulty int;"
+							   "alter table scores add column rows int;"
+							   "alter table scores add column cols int;"
+							   "update scores set rows = 10, cols = 10, difficulty ="
+							   " case when score_ms > 500000 then 2 when score_ms > 250000 then 1 else 0 end;", NULL, NULL, NULL);
+	}
+
+	// Every score query picks one difficulty and walks it best or
+	// worst first, which this index answers without sorting.
+	if (res == SQLITE_OK)
+	{
+		res = sqlite3_exec(db, "drop index if exists scores_score_ms;"
+							   "create index if not exists scores_difficulty_score_ms"
+							   " on scores(difficulty, score_ms desc);", NULL, NULL, NULL);
+	}
+
+	// Version 5 keyed scores and games on what was in them, so imports
+	// could skip rows already there. Version 7 replaces that.
+
+	// Version 6: a saved score can have a replay of its game. The data
+	// blob is kept last in the row and listing is answered by an index
+	// of everything else, so it never reads the blobs. A replay goes
+	// when its score drops off the table.
+	if (res == SQLITE_OK)
+	{
+		res = sqlite3_exec(db, "create table if not exists replays("
+							   "score_id integer primary key,"
+							   "difficulty int,"
+							   "rows int,"
+							   "cols int,"
+							   "mines int,"
+							   "seed int,"
+							   "duration_ms int,"
+							   "moves int,"
+							   "size int,"
+							   "data blob);"
+							   "create index if not exists replays_listing"
+							   " on replays(difficulty, duration_ms, moves, size, seed);"
+							   "create trigger if not exists scores_drop_replay after delete on scores"
+							   " begin delete from replays where score_id = old.id; end;", NULL, NULL, NULL);
+	}
+
+	// Version 7: every score and game has an origin, naming the database
+	// it was first saved in and its id there. Rows keep it through any
+	// number of exports and imports, and an import skips rows whose
+	// origin is already here. Repeat scores and games are all kept;
+	// the version 5 keys, which dropped them, go.
+	if (res == SQLITE_OK && sqlite3_prepare_v2(db, "select origin from scores", -1, &probe, NULL) == SQLITE_OK)
+	{
+		sqlite3_finalize(probe);
+	}
+	else if (res == SQLITE_OK)
+	{
+		res = sqlite3_exec(db, "create table if not exists store(id text);"
+							   "insert into store(id) select lower(hex(randomblob(8)))"
+							   " where not exists (select 1 from store);"
+							   "drop index if exists scores_entry;"
+							   "drop index if exists games_entry;"
+							   "alter table scores add column origin text;"
+							   "alter table games add column origin text;"
+							   "update scores set origin = (select id from store) || '-' || id;"
+							   "update games set origin = (select id from store) || '-' || id;"
+							   "create unique index if not exists scores_origin on scores(origin);"
+							   "create unique index if not exists games_origin on games(origin);"
+							   "create trigger if not exists scores_set_origin after insert on scores"
+							   " when new.origin is null begin"
+							   " update scores set origin = (select id from store) || '-' || new.id where id = new.id; end;"
+							   "create trigger if not exists games_set_origin after insert on games"
+							   " when new.origin is null begin"
+							   " update games set origin = (select id from store) || '-' || new.id where id = new.id; end;",
+						   NULL, NULL, NULL);
+	}
+
+	if (res == SQLITE_OK)
+	{
+		char sql[64];
+		snprintf(sql, sizeof(sql), "pragma user_version = %d;", SCHEMA_VERSION);
+		res = sqlite3_exec(db, sql, NULL, NULL, NULL);
+	}
+
+	return res;
+}
+
+static int MigrateSchema(sqlite3 *db)
+{
+	// Bring the schema up to date in one transaction, so two players
+	// opening an old database at once can't trip over each other's
+	// half finished migration. Whoever gets the write lock second
+	// finds the work already done.
+	if (SchemaVersion(db) >= SCHEMA_VERSION)
+	{
+		return SQLITE_OK;
+	}
+
+	int res = sqlite3_exec(db, "begin immediate;", NULL, NULL, NULL);
+
+	if (res != SQLITE_OK)
+	{
+		return res;
+	}
+
+	if (SchemaVersion(db) < SCHEMA_VERSION)
+	{
+		res = MigrateSteps(db);
+	}
+
+	if (res == SQLITE_OK)
+	{
+		res = sqlite3_exec(db, "commit;", NULL, NULL, NULL);
+	}
+
+	if (res != SQLITE_OK)
+	{
+		sqlite3_exec(db, "rollback;", NULL, NULL, NULL);
+	}
+
+	return res;
+}
+
+static int OpenConnection(struct Connection *connection, const char *path, bool create)
+{
+	int flags = SQLITE_OPEN_READWRITE | (create ? SQLITE_OPEN_CREATE : 0);
+	int res = sqlite3_open_v2(path, &connection->db, flags, NULL);
+
+	if (res != SQLITE_OK)
+	{
+		return res;
+	}
+
+	// Wait on other players' locks instead of failing straight away, and
+	// use write-ahead logging so that reading the table never waits on
+	// somebody else's write, or holds one up.
+	sqlite3_busy_timeout(connection->db, BUSY_TIMEOUT_MS);
+	res = sqlite3_exec(connection->db, "pragma journal_mode = wal;", NULL, NULL, NULL);
+
+	if (res != SQLITE_OK)
+	{
+		return res;
+	}
+
+	res = MigrateSchema(connection->db);
+
+	for (int i = 0; i < STATEMENT_COUNT && res == SQLITE_OK; i++)
+	{
+		res = sqlite3_prepare_v2(connection->db, statementSql[i], -1, &connection->statements[i], NULL);
+	}
+
+	return res;
+}
+
+static int OpenReadOnlyConnection(struct Connection *connection, const char *path)
+{
+	// Open an existing, up to date database just for reading. Nothing
+	// is created or migrated, so there's no write lock to wait on and
+	// no journal to set up.
+	int res = sqlite3_open_v2(path, &connection->db, SQLITE_OPEN_READONLY, NULL);
+
+	if (res != SQLITE_OK)
+	{
+		return res;
+	}
+
+	if (SchemaVersion(connection->db) < SCHEMA_VERSION)
+	{
+		return SQLITE_CANTOPEN;
+	}
+
+	char sql[64];
+	snprintf(sql, sizeof(sql), "pragma mmap_size = %d;", READ_ONLY_MMAP_SIZE);
+	res = sqlite3_exec(connection->db, sql, NULL, NULL, NULL);
+
+	for (int i = 0; i < STATEMENT_COUNT && res == SQLITE_OK; i++)
+	{
+		res = sqlite3_prepare_v2(connection->db, statementSql[i], -1, &connection->statements[i], NULL);
+	}
+
+	return res;
+}
+
+static void CloseConnection(struct Connection *connection)
+{
+	// Finalizing a statement that was never prepared is a no-op.
+	for (int i = 0; i < STATEMENT_COUNT; i++)
+	{
+		sqlite3_finalize(connection->statements[i]);
+		connection->statements[i] = NULL;
+	}
+
+	sqlite3_close(connection->db);
+	connection->db = NULL;
+}
+
+static int Step(struct Connection *connection, enum Statement which)
+{
+	// Run a statement that returns no rows, and leave it ready for next time.
+	sqlite3_stmt *statement = connection->statements[which];
+	int res = sqlite3_step(statement);
+
+	sqlite3_reset(statement);
+	sqlite3_clear_bindings(statement);
+
+	return res == SQLITE_DONE ? SQLITE_OK : res;
+}
+
+static int QueryInt(struct Connection *connection, enum Statement which, int *value, bool *found)
+{
+	// Run a query for a single number, and leave it ready for next time.
+	sqlite3_stmt *statement = connection->statements[which];
+	int res = sqlite3_step(statement);
+
+	*found = res == SQLITE_ROW;
+
+	if (*found)
+	{
+		*value = sqlite3_column_int(statement, 0);
+	}
+
+	sqlite3_reset(statement);
+	sqlite3_clear_bindings(statement);
+
+	return res == SQLITE_ROW || res == SQLITE_DONE ? SQLITE_OK : res;
+}
+
+static int WriteScore(struct Connection *connection, struct PendingWrite *pending, const char *origin, bool *added)
+{
+	// Add a score, then, if that pushes its difficulty's table past the
+	// given number of places, drop whatever fell off the bottom. The
+	// delete walks the index past the last place, so it only touches
+	// rows being removed. Deciding that inside the write transaction
+	// keeps it right when other players are saving too. An imported
+	// score brings its origin, and is skipped if that's already here.
+	// added says whether the score is on the table afterwards. The
+	// caller owns the transaction.
+	enum Statement which = origin != NULL ? IMPORT_SCORE : INSERT;
+	sqlite3_stmt *insert = connection->statements[which];
+	sqlite3_stmt *prune = connection->statements[PRUNE];
+
+	sqlite3_bind_text(insert, 1, pending->name, -1, SQLITE_TRANSIENT);
+	sqlite3_bind_int(insert, 2, pending->difficulty);
+	sqlite3_bind_int(insert, 3, pending->rows);
+	sqlite3_bind_int(insert, 4, pending->cols);
+	sqlite3_bind_int(insert, 5, pending->score);
+	sqlite3_bind_int(insert, 6, pending->scoreMs);
+
+	if (origin != NULL)
+	{
+		sqlite3_bind_text(insert, 7, origin, -1, SQLITE_TRANSIENT);
+	}
+
+	int res = Step(connection, which);
+	sqlite3_int64 id = sqlite3_last_insert_rowid(connection->db);
+
+	*added = false;
+
+	// An imported score that's already here changes nothing.
+	if (res != SQLITE_OK || sqlite3_changes(connection->db) == 0)
+	{
+		return res;
+	}
+
+	// The replay goes in before trimming the table, so if the new score
+	// is what gets trimmed, the replay goes with it.
+	if (pending->hasReplay)
+	{
+		struct Replay *replay = &pending->replay;
+		sqlite3_stmt *save = connection->statements[INSERT_REPLAY];
+
+		sqlite3_bind_int64(save, 1, id);
+		sqlite3_bind_int(save, 2, pending->difficulty);
+		sqlite3_bind_int(save, 3, pending->rows);
+		sqlite3_bind_int(save, 4, pending->cols);
+		sqlite3_bind_int(save, 5, replay->mines);
+		sqlite3_bind_int64(save, 6, replay->seed);
+		sqlite3_bind_int(save, 7, pending->durationMs);
+		sqlite3_bind_int(save, 8, replay->moves);
+		sqlite3_bind_int(save, 9, replay->length);
+		sqlite3_bind_blob(save, 10, replay->data, replay->length, SQLITE_STATIC);
+		res = Step(connection, INSERT_REPLAY);
+	}
+
+	if (res == SQLITE_OK && pending->places > 0)
+	{
+		sqlite3_bind_int(prune, 1, pending->difficulty);
+		sqlite3_bind_int(prune, 2, pending->places);
+		res = Step(connection, PRUNE);
+	}
+
+	if (res == SQLITE_OK)
+	{
+		int kept = 0;
+		bool found;
+
+		sqlite3_bind_int64(connection->statements[SCORE_KEPT], 1, id);
+		res = QueryInt(connection, SCORE_KEPT, &kept, &found);
+		*added = kept > 0;
+	}
+
+	return res;
+}
+
+static int WriteGame(struct Connection *connection, struct GameRecord *game, const char *origin, bool *added)
+{
+	// Add a game to the history and fold it into its difficulty's
+	// totals. Both happen in the caller's transaction, so the totals
+	// always match the history, and an imported game whose origin is
+	// already there isn't counted twice. Only wins count towards 3BV/s.
+	enum Statement which = origin != NULL ? IMPORT_GAME : INSERT_GAME;
+	sqlite3_stmt *insert = connection->statements[which];
+	sqlite3_stmt *update = connection->statements[UPDATE_GAME_STATS];
+	double threeBVPerSecond = 0;
+
+	if (game->won && game->durationMs > 0)
+	{
+		threeBVPerSecond = game->threeBV * 1000.0 / game->durationMs;
+	}
+
+	sqlite3_bind_int64(insert, 1, game->seed);
+	sqlite3_bind_int(insert, 2, game->difficulty);
+	sqlite3_bind_int(insert, 3, game->rows);
+	sqlite3_bind_int(insert, 4, game->cols);
+	sqlite3_bind_int(insert, 5, game->mines);
+	sqlite3_bind_int(insert, 6, game->won);
+	sqlite3_bind_int(insert, 7, game->durationMs);
+	sqlite3_bind_int(insert, 8, game->threeBV);
+	sqlite3_bind_int(insert, 9, game->clicks);
+	sqlite3_bind_int64(insert, 10, game->playedAt);
+
+	if (origin != NULL)
+	{
+		sqlite3_bind_text(insert, 11, origin, -1, SQLITE_TRANSIENT);
+	}
+
+	int res = Step(connection, which);
+
+	*added = res == SQLITE_OK && sqlite3_changes(connection->db) > 0;
+
+	if (!*added)
+	{
+		return res;
+	}
+
+	sqlite3_bind_int(connection->statements[ADD_GAME_STATS], 1, game->difficulty);
+	res = Step(connection, ADD_GAME_STATS);
+
+	if (res == SQLITE_OK)
+	{
+		sqlite3_bind_int(update, 1, game->difficulty);
+		sqlite3_bind_int(update, 2, game->won);
+		sqlite3_bind_int(update, 3, game->durationMs);
+		sqlite3_bind_double(update, 4, threeBVPerSecond);
+		res = Step(connection, UPDATE_GAME_STATS);
+	}
+
+	return res;
+}
+
+static int EndTransaction(struct Connection *connection, int res)
+{
+	// Commit if everything so far worked, otherwise roll back.
+	connection->rollbackError[0] = '\0';
+
+	if (res == SQLITE_OK)
+	{
+		res = Step(connection, COMMIT);
+	}
+
+	if (res != SQLITE_OK && !sqlite3_get_autocommit(connection->db))
+	{
+		snprintf(connection->rollbackError, sizeof(connection->rollbackError), "%s", sqlite3_errmsg(connection->db));
+		Step(connection, ROLLBACK);
+	}
+
+	return res;
+}
+
+static int WriteBatch(struct Connection *connection, struct PendingWrite *writes, int count)
+{
+	// Write a batch of scores and games in one transaction. If other players hold
+	// the database for longer than the busy timeout, back off and retry.
+	int res = SQLITE_BUSY;
+	int backoff = BUSY_BACKOFF_US;
+	int attempt;
+
+	for (attempt = 0; attempt <= BUSY_RETRIES; attempt++)
+	{
+		if (attempt > 0)
+		{
+			usleep(backoff + rand() % backoff);
+			backoff *= 2;
+		}
+
+		res = Step(connection, BEGIN);
+
+		for (int i = 0; i < count && res == SQLITE_OK; i++)
+		{
+			bool added;
+
+			if (writes[i].kind == WRITE_GAME)
+			{
+				res = WriteGame(connection, &writes[i].game, NULL, &added);
+			}
+			else
+			{
+				res = WriteScore(connection, &writes[i], NULL, &added);
+			}
+		}
+
+		res = EndTransaction(connection, res);
+
+		if (res != SQLITE_BUSY && res != SQLITE_LOCKED)
+		{
+			break;
+		}
+	}
+
+	HistogramRecord(&busyRetries, attempt > BUSY_RETRIES ? BUSY_RETRIES : attempt);
+	return res;
+}
+
+int ScoreStoreOpen(const char *path)
+{
+	long long start = MonotonicNanos();
+
+	openResult = OpenConnection(&reader, path, true);
+	storePath = strdup(path);
+
+	HistogramRecord(&openTime, MonotonicNanos() - start);
+	return openResult;
+}
+
+void ScoreStoreOpenReadOnly(const char *path)
+{
+	// Nothing is opened until something needs the database, which it
+	// may never do if the daemon answers for it.
+	storePath = strdup(path);
+	openDeferred = true;
+	openResult = SQLITE_OK;
+}
+
+static void OpenDeferred()
+{
+	// Fall back to a normal open if the database can't be read as it
+	// is, because it needs its schema updated, but never create it.
+	long long start = MonotonicNanos();
+
+	openResult = OpenReadOnlyConnection(&reader, storePath);
+
+	if (openResult != SQLITE_OK)
+	{
+		CloseConnection(&reader);
+		openResult = OpenConnection(&reader, storePath, false);
+	}
+
+	HistogramRecord(&openTime, MonotonicNanos() - start);
+}
+
+static void *OpenerThread(void *arg)
+{
+	long long start = MonotonicNanos();
+
+	openResult = OpenConnection(&reader, storePath, true);
+
+	HistogramRecord(&openTime, MonotonicNanos() - start);
+	return NULL;
+}
+
+void ScoreStoreOpenAsync(const char *path)
+{
+	storePath = strdup(path);
+
+	if (pthread_create(&openerThread, NULL, OpenerThread, NULL) == 0)
+	{
+		openerRunning = true;
+	}
+	else
+	{
+		ScoreStoreOpen(path);
+	}
+}
+
+static int WaitForOpen()
+{
+	// Only the game's own thread calls into the store, so
+	// openerRunning needs no lock.
+	if (openerRunning)
+	{
+		pthread_join(openerThread, NULL);
+		openerRunning = false;
+	}
+
+	if (openDeferred)
+	{
+		openDeferred = false;
+		OpenDeferred();
+	}
+
+	return openResult;
+}
+
+void ScoreStoreUseDaemon(const char *path)
+{
+	ScoreClientClose();
+	free(daemonPath);
+
+	daemonPath = path != NULL ? strdup(path) : NULL;
+	daemonTried = false;
+}
+
+static bool DaemonReady()
+{
+	if (daemonPath != NULL && !daemonTried)
+	{
+		daemonTried = true;
+		ScoreClientConnect(daemonPath);
+	}
+
+	return ScoreClientConnected();
+}
+
+void ScoreStoreClose()
+{
+	// Make sure anything still queued is committed before closing.
+	WaitForOpen();
+	ScoreStoreFlush();
+
+	CloseConnection(&reader);
+	openResult = SQLITE_MISUSE;
+
+	ScoreStoreUseDaemon(NULL);
+
+	free(storePath);
+	storePath = NULL;
+}
+
+const char *ScoreStoreError()
+{
+	WaitForOpen();
+
+	return reader.rollbackError[0] != '\0' ? reader.rollbackError : sqlite3_errmsg(reader.db);
+}
+
+int ScoreStorePlace(int difficulty, int scoreMs, int places, struct Placing *placing)
+{
+	// Every query here walks one difficulty's part of the score index
+	// from one end, and none of them looks at more than places rows,
+	// so the cost doesn't grow with the size of the table.
+	long long start = MonotonicNanos();
+	int cutoffMs = 0;
+	bool found;
+
+	if (DaemonReady() && ScoreClientPlace(difficulty, scoreMs, places, placing))
+	{
+		HistogramRecord(&placeTime, MonotonicNanos() - start);
+		return SQLITE_OK;
+	}
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	placing->qualifies = true;
+	placing->rank = 0;
+
+	// The score in last place on the table, if the table is full.
+	sqlite3_bind_int(reader.statements[CUTOFF], 1, difficulty);
+	sqlite3_bind_int(reader.statements[CUTOFF], 2, places - 1);
+	int res = QueryInt(&reader, CUTOFF, &cutoffMs, &found);
+
+	if (res == SQLITE_OK && found && scoreMs < cutoffMs)
+	{
+		placing->qualifies = false;
+	}
+
+	if (res == SQLITE_OK && placing->qualifies)
+	{
+		sqlite3_bind_int(reader.statements[RANK], 1, difficulty);
+		sqlite3_bind_int(reader.statements[RANK], 2, scoreMs);
+		res = QueryInt(&reader, RANK, &placing->rank, &found);
+		placing->rank++;
+	}
+
+	HistogramRecord(&placeTime, MonotonicNanos() - start);
+	return res;
+}
+
+int ScoreStoreInsert(const char *name, int difficulty, int rows, int cols, int score, int scoreMs, int places)
+{
+	// Write a score straight away, in its own transaction.
+	long long start = MonotonicNanos();
+	struct PendingWrite pending;
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	pending.kind = WRITE_SCORE;
+	snprintf(pending.name, sizeof(pending.name), "%s", name);
+	pending.difficulty = difficulty;
+	pending.rows = rows;
+	pending.cols = cols;
+	pending.score = score;
+	pending.scoreMs = scoreMs;
+	pending.places = places;
+	pending.hasReplay = false;
+
+	int res = WriteBatch(&reader, &pending, 1);
+
+	HistogramRecord(&insertTime, MonotonicNanos() - start);
+	return res;
+}
+
+int ScoreStoreTop(int difficulty, int limit, void (*row)(const char *name, int scoreMs))
+{
+	// Call row() for each of the best limit scores on a difficulty, best first.
+	long long start = MonotonicNanos();
+	int res;
+
+	if (DaemonReady() && ScoreClientTop(difficulty, limit, row))
+	{
+		HistogramRecord(&topTime, MonotonicNanos() - start);
+		return SQLITE_OK;
+	}
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	sqlite3_stmt *top = reader.statements[TOP];
+
+	sqlite3_bind_int(top, 1, difficulty);
+	sqlite3_bind_int(top, 2, limit);
+
+	while ((res = sqlite3_step(top)) == SQLITE_ROW)
+	{
+		row((const char *) sqlite3_column_text(top, 0), sqlite3_column_int(top, 1));
+	}
+
+	sqlite3_reset(top);
+	sqlite3_clear_bindings(top);
+
+	HistogramRecord(&topTime, MonotonicNanos() - start);
+	return res == SQLITE_DONE ? SQLITE_OK : res;
+}
+
+int ScoreStoreDataVersion(int *version)
+{
+	// SQLite's data_version changes whenever another connection,
+	// including the writer thread's, commits to the database.
+	bool found;
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	return QueryInt(&reader, DATA_VERSION, version, &found);
+}
+
+int ScoreStoreGameStats(void (*row)(const struct GameStats *stats))
+{
+	// Call row() for each difficulty that has been played. These are
+	// the running totals, so this reads one row per difficulty however
+	// long the history gets.
+	long long start = MonotonicNanos();
+	struct GameStats stats;
+	int res;
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	sqlite3_stmt *query = reader.statements[GAME_STATS];
+
+	while ((res = sqlite3_step(query)) == SQLITE_ROW)
+	{
+		stats.difficulty = sqlite3_column_int(query, 0);
+		stats.games = sqlite3_column_int(query, 1);
+		stats.wins = sqlite3_column_int(query, 2);
+		stats.bestMs = sqlite3_column_type(query, 3) == SQLITE_NULL ? -1 : sqlite3_column_int(query, 3);
+		stats.mean3BVPerSecond = stats.wins > 0 ? sqlite3_column_double(query, 4) / stats.wins : 0;
+		row(&stats);
+	}
+
+	sqlite3_reset(query);
+
+	HistogramRecord(&gameStatsTime, MonotonicNanos() - start);
+	return res == SQLITE_DONE ? SQLITE_OK : res;
+}
+
+int ScoreStoreListReplays(void (*row)(const struct ReplayInfo *info, const char *name))
+{
+	// Call row() for every stored replay, by difficulty and then fastest
+	// first. The replays are read through their listing index alone.
+	struct ReplayInfo info;
+	int res;
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	sqlite3_stmt *list = reader.statements[LIST_REPLAYS];
+
+	memset(&info, 0, sizeof(info));
+
+	while ((res = sqlite3_step(list)) == SQLITE_ROW)
+	{
+		info.id = sqlite3_column_int(list, 0);
+		info.difficulty = sqlite3_column_int(list, 1);
+		info.durationMs = sqlite3_column_int(list, 2);
+		info.moves = sqlite3_column_int(list, 3);
+		info.size = sqlite3_column_int(list, 4);
+		info.seed = sqlite3_column_int64(list, 5);
+		row(&info, (const char *) sqlite3_column_text(list, 6));
+	}
+
+	sqlite3_reset(list);
+	return res == SQLITE_DONE ? SQLITE_OK : res;
+}
+
+int ScoreStoreFindReplay(int id, struct ReplayInfo *info)
+{
+	// Look up everything about a replay but its moves.
+	sqlite3_stmt *query;
+	bool found;
+	int res;
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	query = reader.statements[REPLAY_INFO];
+	sqlite3_bind_int(query, 1, id);
+	res = sqlite3_step(query);
+	found = res == SQLITE_ROW;
+
+	if (found)
+	{
+		info->id = id;
+		info->difficulty = sqlite3_column_int(query, 0);
+		info->durationMs = sqlite3_column_int(query, 1);
+		info->moves = sqlite3_column_int(query, 2);
+		info->size = sqlite3_column_int(query, 3);
+		info->seed = sqlite3_column_int64(query, 4);
+		info->rows = sqlite3_column_int(query, 5);
+		info->cols = sqlite3_column_int(query, 6);
+		info->mines = sqlite3_column_int(query, 7);
+	}
+
+	sqlite3_reset(query);
+	sqlite3_clear_bindings(query);
+
+	if (!found)
+	{
+		return res == SQLITE_DONE ? SQLITE_NOTFOUND : res;
+	}
+
+	return SQLITE_OK;
+}
+
+int ScoreStoreReadReplay(const struct ReplayInfo *info, void (*move)(const struct ReplayMove *move))
+{
+	// Stream a replay's moves out of its blob a chunk at a time,
+	// instead of loading the whole row.
+	long long start = MonotonicNanos();
+	sqlite3_blob *blob;
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	int res = sqlite3_blob_open(reader.db, "main", "replays", "data", info->id, 0, &blob);
+
+	if (res != SQLITE_OK)
+	{
+		return res;
+	}
+
+	unsigned char chunk[REPLAY_CHUNK];
+	struct ReplayDecoder decoder;
+	struct ReplayMove decoded;
+	int size = sqlite3_blob_bytes(blob);
+
+	ReplayDecoderReset(&decoder, info->rows, info->cols);
+
+	for (int offset = 0; offset < size && res == SQLITE_OK; offset += REPLAY_CHUNK)
+	{
+		int length = size - offset < REPLAY_CHUNK ? size - offset : REPLAY_CHUNK;
+
+		res = sqlite3_blob_read(blob, chunk, length, offset);
+
+		for (int i = 0; i < length && res == SQLITE_OK; i++)
+		{
+			if (ReplayDecode(&decoder, chunk[i], &decoded))
+			{
+				move(&decoded);
+			}
+			else if (decoder.corrupt)
+			{
+				res = SQLITE_CORRUPT;
+			}
+		}
+	}
+
+	sqlite3_blob_close(blob);
+
+	HistogramRecord(&replayReadTime, MonotonicNanos() - start);
+	return res;
+}
+
+static void WriteCsvText(FILE *out, const char *text)
+{
+	// Quote a text field, doubling any quotes inside it. Rows are read
+	// back a line at a time, so line breaks are written as \n and \r,
+	// and backslashes doubled.
+	putc('"', out);
+
+	for (; *text != '\0'; text++)
+	{
+		if (*text == '"')
+		{
+			putc('"', out);
+		}
+		else if (*text == '\\' || *text == '\n' || *text == '\r')
+		{
+			putc('\\', out);
+			putc(*text == '\n' ? 'n' : *text == '\r' ? 'r' : '\\', out);
+			continue;
+		}
+
+		putc(*text, out);
+	}
+
+	putc('"', out);
+}
+
+static int SplitCsv(char *line, char **fields, int maxFields)
+{
+	// Split a line into its fields in place, undoing any quoting.
+	// Returns the number of fields.
+	char *in = line;
+	int count = 0;
+
+	while (count < maxFields)
+	{
+		char *out = in;
+		fields[count++] = out;
+
+		if (*in == '"')
+		{
+			for (in++; *in != '\0' && !(in[0] == '"' && in[1] != '"'); in++)
+			{
+				if (*in == '"')
+				{
+					in++;
+				}
+				else if (*in == '\\' && in[1] != '\0')
+				{
+					in++;
+					*out++ = *in == 'n' ? '\n' : *in == 'r' ? '\r' : *in;
+					continue;
+				}
+
+				*out++ = *in;
+			}
+
+			if (*in == '"')
+			{
+				in++;
+			}
+		}
+		else
+		{
+			while (*in != ',' && *in != '\n' && *in != '\r' && *in != '\0')
+			{
+				*out++ = *in++;
+			}
+		}
+
+		char end = *in;
+		*out = '\0';
+
+		if (end != ',')
+		{
+			break;
+		}
+
+		in++;
+	}
+
+	return count;
+}
+
+static bool ParseNumber(const char *text, long long *value)
+{
+	char *end;
+
+	*value = strtoll(text, &end, 10);
+	return end != text && *end == '\0';
+}
+
+int ScoreStoreExport(FILE *out, long long *rows)
+{
+	// Write every score and game out as CSV, one row at a time, so
+	// it takes the same memory however big the tables are. Both
+	// tables are read inside one transaction so they agree.
+	*rows = 0;
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	int res = sqlite3_exec(reader.db, "begin", NULL, NULL, NULL);
+
+	if (res != SQLITE_OK)
+	{
+		return res;
+	}
+
+	fprintf(out, "# score,difficulty,rows,cols,score,score_ms,name,origin\n");
+	fprintf(out, "# game,seed,difficulty,rows,cols,mines,won,duration_ms,three_bv,clicks,played_at,origin\n");
+
+	sqlite3_stmt *scores = reader.statements[EXPORT_SCORES];
+
+	while ((res = sqlite3_step(scores)) == SQLITE_ROW)
+	{
+		fprintf(out, "score,%d,%d,%d,%d,%d,", sqlite3_column_int(scores, 0), sqlite3_column_int(scores, 1),
+				sqlite3_column_int(scores, 2), sqlite3_column_int(scores, 3), sqlite3_column_int(scores, 4));
+		WriteCsvText(out, (const char *) sqlite3_column_text(scores, 5));
+		fprintf(out, ",%s\n", sqlite3_column_text(scores, 6));
+		(*rows)++;
+	}
+
+	sqlite3_reset(scores);
+	sqlite3_stmt *games = reader.statements[EXPORT_GAMES];
+
+	if (res == SQLITE_DONE)
+	{
+		while ((res = sqlite3_step(games)) == SQLITE_ROW)
+		{
+			fprintf(out, "game,%lld,%d,%d,%d,%d,%d,%d,%d,%d,%lld,%s\n", sqlite3_column_int64(games, 0),
+					sqlite3_column_int(games, 1), sqlite3_column_int(games, 2), sqlite3_column_int(games, 3),
+					sqlite3_column_int(games, 4), sqlite3_column_int(games, 5), sqlite3_column_int(games, 6),
+					sqlite3_column_int(games, 7), sqlite3_column_int(games, 8), sqlite3_column_int64(games, 9),
+					sqlite3_column_text(games, 10));
+			(*rows)++;
+		}
+	}
+
+	sqlite3_reset(games);
+	sqlite3_exec(reader.db, "commit", NULL, NULL, NULL);
+
+	if (res == SQLITE_DONE && ferror(out))
+	{
+		snprintf(reader.rollbackError, sizeof(reader.rollbackError), "%s", "couldn't write the export");
+		return SQLITE_IOERR;
+	}
+
+	return res == SQLITE_DONE ? SQLITE_OK : res;
+}
+
+static bool ParseImportRow(char *line, int places, struct PendingWrite *pending, const char **origin)
+{
+	// Turn one row of the export format back into a score or a game,
+	// along with its origin. Exports from before origins were kept
+	// don't have one, and their rows are always added.
+	char *fields[CSV_FIELDS];
+	long long numbers[CSV_FIELDS];
+	int count = SplitCsv(line, fields, CSV_FIELDS);
+	int last;
+	int originField;
+
+	*origin = NULL;
+
+	if (strcmp(fields[0], "score") == 0 && (count == 7 || count == 8))
+	{
+		pending->kind = WRITE_SCORE;
+		last = 6;
+		originField = 7;
+	}
+	else if (strcmp(fields[0], "game") == 0 && (count == 11 || count == 12))
+	{
+		pending->kind = WRITE_GAME;
+		last = 11;
+		originField = 11;
+	}
+	else
+	{
+		return false;
+	}
+
+	if (count > originField && fields[originField][0] != '\0')
+	{
+		*origin = fields[originField];
+	}
+
+	for (int i = 1; i < last; i++)
+	{
+		if (!ParseNumber(fields[i], &numbers[i]))
+		{
+			return false;
+		}
+	}
+
+	if (pending->kind == WRITE_SCORE)
+	{
+		pending->difficulty = numbers[1];
+		pending->rows = numbers[2];
+		pending->cols = numbers[3];
+		pending->score = numbers[4];
+		pending->scoreMs = numbers[5];
+		pending->places = places;
+		pending->hasReplay = false;
+		snprintf(pending->name, sizeof(pending->name), "%s", fields[6]);
+	}
+	else
+	{
+		pending->game.seed = numbers[1];
+		pending->game.difficulty = numbers[2];
+		pending->game.rows = numbers[3];
+		pending->game.cols = numbers[4];
+		pending->game.mines = numbers[5];
+		pending->game.won = numbers[6];
+		pending->game.durationMs = numbers[7];
+		pending->game.threeBV = numbers[8];
+		pending->game.clicks = numbers[9];
+		pending->game.playedAt = numbers[10];
+	}
+
+	return true;
+}
+
+static int ImportBatch(FILE *in, int places, long long *line, long long *rows, long long *added)
+{
+	// Read and write up to IMPORT_BATCH_ROWS rows in one transaction.
+	// Only one row is held in memory at a time.
+	char text[CSV_LINE_LENGTH];
+	struct PendingWrite pending;
+	const char *origin;
+	bool rowAdded;
+
+	*rows = 0;
+	*added = 0;
+
+	int res = Step(&reader, BEGIN);
+
+	while (res == SQLITE_OK && *rows < IMPORT_BATCH_ROWS && fgets(text, sizeof(text), in) != NULL)
+	{
+		(*line)++;
+
+		if (text[0] == '#' || text[0] == '\n')
+		{
+			continue;
+		}
+
+		if (strchr(text, '\n') == NULL && !feof(in))
+		{
+			res = SQLITE_TOOBIG;
+			break;
+		}
+
+		if (!ParseImportRow(text, places, &pending, &origin))
+		{
+			res = SQLITE_MISMATCH;
+			break;
+		}
+
+		if (pending.kind == WRITE_GAME)
+		{
+			res = WriteGame(&reader, &pending.game, origin, &rowAdded);
+		}
+		else
+		{
+			res = WriteScore(&reader, &pending, origin, &rowAdded);
+		}
+
+		*added += rowAdded;
+
+		(*rows)++;
+	}
+
+	if (res == SQLITE_OK && ferror(in))
+	{
+		res = SQLITE_IOERR;
+	}
+
+	int failure = res;
+	res = EndTransaction(&reader, res);
+
+	if (failure == SQLITE_TOOBIG || failure == SQLITE_MISMATCH || failure == SQLITE_IOERR)
+	{
+		snprintf(reader.rollbackError, sizeof(reader.rollbackError), "%s on line %lld",
+				 failure == SQLITE_IOERR ? "can't read the import" : "bad row", *line);
+	}
+
+	return res;
+}
+
+int ScoreStoreImport(FILE *in, int places, long long *rows, long long *added)
+{
+	// Read an export back in, in large batches. Rows that are already
+	// in the database are skipped, and scores are trimmed to places per
+	// difficulty as they go in. If the database stays busy a batch is
+	// rolled back, and read again after backing off when the file can
+	// be rewound.
+	long long line = 0;
+	int res;
+
+	*rows = 0;
+	*added = 0;
+
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	do
+	{
+		long batchStart = ftell(in);
+		long long batchLine = line;
+		long long batchRows;
+		long long batchAdded;
+		int backoff = BUSY_BACKOFF_US;
+		long long start = MonotonicNanos();
+
+		for (int attempt = 0; ; attempt++)
+		{
+			res = ImportBatch(in, places, &line, &batchRows, &batchAdded);
+
+			if ((res != SQLITE_BUSY && res != SQLITE_LOCKED) || attempt == BUSY_RETRIES || batchStart < 0)
+			{
+				break;
+			}
+
+			usleep(backoff + rand() % backoff);
+			backoff *= 2;
+
+			fseek(in, batchStart, SEEK_SET);
+			line = batchLine;
+		}
+
+		HistogramRecord(&importBatchTime, MonotonicNanos() - start);
+
+		if (res == SQLITE_OK)
+		{
+			*rows += batchRows;
+			*added += batchAdded;
+		}
+	} while (res == SQLITE_OK && !feof(in));
+
+	return res;
+}
+
+static void *WriterThread(void *arg)
+{
+	// Open the writer's connection here rather than hold up whoever
+	// queued the first write. Then take everything that's queued, write
+	// it all in one transaction, and only then tell the game those
+	// scores are saved.
+	struct PendingWrite batch[WRITE_QUEUE_SIZE];
+
+	if (OpenConnection(&writer, storePath, true) != SQLITE_OK)
+	{
+		CloseConnection(&writer);
+	}
+
+	pthread_mutex_lock(&queueMutex);
+
+	while (true)
+	{
+		while (queueLength == 0 && !writerStopping)
+		{
+			pthread_cond_wait(&queueNotEmpty, &queueMutex);
+		}
+
+		if (queueLength == 0)
+		{
+			break;
+		}
+
+		int count = queueLength;
+
+		for (int i = 0; i < count; i++)
+		{
+			batch[i] = writeQueue[(queueHead + i) % WRITE_QUEUE_SIZE];
+		}
+
+		queueHead = (queueHead + count) % WRITE_QUEUE_SIZE;
+		queueLength = 0;
+		pthread_cond_broadcast(&queueNotFull);
+		pthread_mutex_unlock(&queueMutex);
+
+		long long start = MonotonicNanos();
+		int res = writer.db != NULL ? WriteBatch(&writer, batch, count) : SQLITE_CANTOPEN;
+		bool opened = writer.db != NULL;
+
+		HistogramRecord(&batchTime, MonotonicNanos() - start);
+		HistogramRecord(&batchSize, count);
+
+		for (int i = 0; i < count; i++)
+		{
+			if (batch[i].status != NULL)
+			{
+				*batch[i].status = res == SQLITE_OK ? SCORE_SAVED : SCORE_FAILED;
+			}
+		}
+
+		pthread_mutex_lock(&queueMutex);
+
+		// Without a connection, fail everything that's been queued and
+		// leave it to the next write to start a writer that tries
+		// opening again.
+		if (!opened && queueLength == 0)
+		{
+			writerRunning = false;
+			pthread_detach(pthread_self());
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&queueMutex);
+	return NULL;
+}
+
+static int QueueWrite(struct PendingWrite *write)
+{
+	// Hand a write to the writer thread, starting it the first time.
+	// This only waits if the queue is full. The reader is opened first
+	// so the writer never races it to create the schema.
+	if (WaitForOpen() != SQLITE_OK)
+	{
+		return openResult;
+	}
+
+	pthread_mutex_lock(&queueMutex);
+
+	if (!writerRunning)
+	{
+		writerStopping = false;
+
+		if (pthread_create(&writerThread, NULL, WriterThread, NULL) != 0)
+		{
+			pthread_mutex_unlock(&queueMutex);
+			return SQLITE_ERROR;
+		}
+
+		writerRunning = true;
+	}
+
+	while (queueLength == WRITE_QUEUE_SIZE)
+	{
+		pthread_cond_wait(&queueNotFull, &queueMutex);
+	}
+
+	writeQueue[(queueHead + queueLength) % WRITE_QUEUE_SIZE] = *write;
+
+	if (write->status != NULL)
+	{
+		*write->status = SCORE_SAVING;
+	}
+
+	queueLength++;
+	pthread_cond_signal(&queueNotEmpty);
+	pthread_mutex_unlock(&queueMutex);
+
+	return SQLITE_OK;
+}
+
+int ScoreStoreQueue(const char *name, int difficulty, int rows, int cols, int score, int scoreMs, int places,
+					const struct Replay *replay, int durationMs, atomic_int *status)
+{
+	struct PendingWrite pending;
+
+	// The daemon only answers once its writer thread has committed the
+	// score, so once it has answered the score counts as saved.
+	if (DaemonReady() && ScoreClientSave(name, difficulty, rows, cols, score, scoreMs, places, replay, durationMs))
+	{
+		if (status != NULL)
+		{
+			*status = SCORE_SAVED;
+		}
+
+		return SQLITE_OK;
+	}
+
+	pending.kind = WRITE_SCORE;
+	snprintf(pending.name, sizeof(pending.name), "%s", name);
+	pending.difficulty = difficulty;
+	pending.rows = rows;
+	pending.cols = cols;
+	pending.score = score;
+	pending.scoreMs = scoreMs;
+	pending.places = places;
+	pending.hasReplay = replay != NULL;
+	pending.durationMs = durationMs;
+	pending.status = status;
+
+	if (replay != NULL)
+	{
+		pending.replay = *replay;
+	}
+
+	return QueueWrite(&pending);
+}
+
+int ScoreStoreQueueGame(const struct GameRecord *game, atomic_int *status)
+{
+	struct PendingWrite pending;
+
+	pending.kind = WRITE_GAME;
+	pending.game = *game;
+	pending.status = status;
+
+	return QueueWrite(&pending);
+}
+
+void ScoreStoreFlush()
+{
+	// Let the writer finish whatever is queued, then stop it.
+	pthread_mutex_lock(&queueMutex);
+
+	if (!writerRunning)
+	{
+		pthread_mutex_unlock(&queueMutex);
+		return;
+	}
+
+	writerStopping = true;
+	pthread_cond_signal(&queueNotEmpty);
+	pthread_mutex_unlock(&queueMutex);
+
+	pthread_join(writerThread, NULL);
+
+	CloseConnection(&writer);
+	writerRunning = false;
+}
+
+void ScoreStorePrintStats(FILE *out)
+{
+	HistogramPrint(out, "score store open", &openTime, 1000.0, "us");
+	HistogramPrint(out, "score store place", &placeTime, 1000.0, "us");
+	HistogramPrint(out, "score store insert", &insertTime, 1000.0, "us");
+	HistogramPrint(out, "score store top", &topTime, 1000.0, "us");
+	HistogramPrint(out, "score store game stats", &gameStatsTime, 1000.0, "us");
+	HistogramPrint(out, "score writer commit", &batchTime, 1000.0, "us");
+	HistogramPrint(out, "score writer batch", &batchSize, 1.0, "scores");
+	HistogramPrint(out, "score busy retries", &busyRetries, 1.0, "retries");
+	HistogramPrint(out, "import batch commit", &importBatchTime, 1000.0, "us");
+	HistogramPrint(out, "replay read", &replayReadTime, 1000.0, "us");
+}
@@ -0,0 +1,139 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - high score storage
+
+#ifndef SCORESTORE_H
+#define SCORESTORE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#include "replay.h"
+
+// The high score table and game history in scores.db. Every statement is prepared once
+// when the store is opened and reused with bound parameters, so names
+// are never pasted into SQL and nothing is parsed twice.
+//
+// The database is shared by everyone playing on the machine, so it's
+// kept in WAL mode and writes back off and retry while it's busy.
+//
+// Functions return an SQLite result code; ScoreStoreError() describes
+// the last failure.
+
+#define SCORE_NAME_LENGTH 256
+
+// Progress of a score handed to the writer thread.
+enum SaveStatus {
+	SCORE_UNSAVED,
+	SCORE_SAVING,
+	SCORE_SAVED,
+	SCORE_FAILED
+};
+
+// A finished game, won or lost, for the games history.
+struct GameRecord {
+	unsigned seed;
+	int difficulty;
+	int rows;
+	int cols;
+	int mines;
+	bool won;
+	int durationMs;
+	int threeBV;
+	int clicks;
+	// Unix time the game finished, or 0 for now.
+	long long playedAt;
+};
+
+// Running totals for one difficulty. bestMs is -1 until it's been won,
+// and 3BV/s is averaged over wins only.
+struct GameStats {
+	int difficulty;
+	int games;
+	int wins;
+	int bestMs;
+	double mean3BVPerSecond;
+};
+
+// A stored replay. The listing fills in everything but rows, cols
+// and mines; reading the replay fills in all of it.
+struct ReplayInfo {
+	int id;
+	int difficulty;
+	int rows;
+	int cols;
+	int mines;
+	unsigned seed;
+	int durationMs;
+	int moves;
+	int size;
+};
+
+// Each difficulty has its own table of scores. Where a new score
+// would land on one with the given number of places.
+struct Placing {
+	bool qualifies;
+	int rank;
+};
+
+int ScoreStoreOpen(const char *path);
+// Only for looking at the tables: the database is opened read only
+// and memory mapped, unless it first needs updating. That happens when
+// it's first needed, and any error comes from that call. It's never
+// created, so if it isn't there that call returns SQLITE_CANTOPEN.
+void ScoreStoreOpenReadOnly(const char *path);
+// Open the database on a background thread. Whatever uses the store
+// first waits for it, and gets the result of opening it.
+void ScoreStoreOpenAsync(const char *path);
+// Read and save the high score tables through minesweeperd on the given
+// socket when it's running, and go to the database when it isn't.
+// NULL stops using the daemon.
+void ScoreStoreUseDaemon(const char *path);
+void ScoreStoreClose();
+const char *ScoreStoreError();
+
+int ScoreStorePlace(int difficulty, int scoreMs, int places, struct Placing *placing);
+// Saving a score with places set drops the lowest scores whenever its
+// difficulty's table would otherwise grow past that many places.
+int ScoreStoreInsert(const char *name, int difficulty, int rows, int cols, int score, int scoreMs, int places);
+int ScoreStoreTop(int difficulty, int limit, void (*row)(const char *name, int scoreMs));
+// Changes whenever something else commits to the database.
+int ScoreStoreDataVersion(int *version);
+int ScoreStoreGameStats(void (*row)(const struct GameStats *stats));
+
+// Write behind: scores and games are queued for a writer thread, which
+// commits whatever has built up in one transaction and then sets each
+// one's status, if given, to SCORE_SAVED or SCORE_FAILED. A game updates
+// its difficulty's totals in the same transaction that records it. ScoreStoreFlush() waits for
+// the queue to drain; ScoreStoreClose() does it too.
+// A queued score can bring the replay of its game along, which is
+// kept for as long as the score stays on the table, with durationMs,
+// how long the game took.
+int ScoreStoreQueue(const char *name, int difficulty, int rows, int cols, int score, int scoreMs, int places,
+					const struct Replay *replay, int durationMs, atomic_int *status);
+int ScoreStoreQueueGame(const struct GameRecord *game, atomic_int *status);
+void ScoreStoreFlush();
+
+// Replays are listed without reading their data, and read back a
+// move at a time. A replay's id is the id of its score; finding one
+// that doesn't exist returns SQLITE_NOTFOUND, and reading one whose
+// data doesn't decode stops there and returns SQLITE_CORRUPT.
+int ScoreStoreListReplays(void (*row)(const struct ReplayInfo *info, const char *name));
+int ScoreStoreFindReplay(int id, struct ReplayInfo *info);
+int ScoreStoreReadReplay(const struct ReplayInfo *info, void (*move)(const struct ReplayMove *move));
+
+// Copy every score and game out to a CSV file, or merge one back in.
+// Both stream a row at a time. Every row carries its origin, the
+// database it was first saved in and its id there. Importing commits
+// in large batches, skips rows whose origin is already in the
+// database, and trims the high score tables to places per difficulty.
+// rows counts the rows read or written, and added the ones that were
+// new and stayed.
+int ScoreStoreExport(FILE *out, long long *rows);
+int ScoreStoreImport(FILE *in, int places, long long *rows, long long *added);
+
+void ScoreStorePrintStats(FILE *out);
+
+#endif
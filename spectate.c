@@ -0,0 +1,329 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - spectators
+
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/un.h>
+#include <sys/socket.h>
+
+#include "stats.h"
+#include "spectate.h"
+
+// One spectator, kept after they leave so they can be reported on.
+// waitingSince is when the backlog waiting to go to them started to
+// build, and maxLagNanos the longest one has lasted. midLine is set
+// when the start of output is the rest of a line already partly sent.
+struct Watcher {
+	int fd;
+	bool resync;
+	char output[SPECTATE_BUFFER_LENGTH];
+	int outputLength;
+	int outputSent;
+	bool midLine;
+	long long waitingSince;
+	long long bytesSent;
+	long long updates;
+	long long drops;
+	long long maxBacklog;
+	long long maxLagNanos;
+};
+
+static int listener = -1;
+static char *listenPath;
+static struct Watcher *watchers[SPECTATE_MAX_WATCHERS];
+static int watcherCount;
+
+// What the spectators were last told, so nothing is sent twice.
+static char lastState;
+static int lastMinesLeft;
+static int lastSeconds;
+static int lastRow;
+static int lastCol;
+
+bool SpectateOpen(const char *path)
+{
+	struct sockaddr_un address;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		return false;
+	}
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+	unlink(path);
+
+	listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+
+	if (listener < 0 || bind(listener, (struct sockaddr *) &address, sizeof(address)) != 0 ||
+		listen(listener, SPECTATE_MAX_WATCHERS) != 0)
+	{
+		if (listener >= 0)
+		{
+			close(listener);
+			listener = -1;
+		}
+
+		return false;
+	}
+
+	listenPath = strdup(path);
+	return true;
+}
+
+static void AcceptWatchers()
+{
+	// Take anyone waiting, and give them the whole game first.
+	int client;
+
+	while (watcherCount < SPECTATE_MAX_WATCHERS && (client = accept(listener, NULL, NULL)) >= 0)
+	{
+		struct Watcher *watcher = calloc(1, sizeof(*watcher));
+
+		if (watcher == NULL)
+		{
+			close(client);
+			return;
+		}
+
+		fcntl(client, F_SETFL, fcntl(client, F_GETFL) | O_NONBLOCK);
+		watcher->fd = client;
+		watcher->resync = true;
+		watchers[watcherCount++] = watcher;
+	}
+}
+
+static void Send(struct Watcher *watcher)
+{
+	// Send as much as the socket takes right now, and note how long
+	// what was waiting had to.
+	if (watcher->outputSent == watcher->outputLength)
+	{
+		return;
+	}
+
+	while (watcher->outputSent < watcher->outputLength)
+	{
+		ssize_t sent = send(watcher->fd, watcher->output + watcher->outputSent,
+							watcher->outputLength - watcher->outputSent, MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (sent < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+			{
+				close(watcher->fd);
+				watcher->fd = -1;
+			}
+
+			break;
+		}
+
+		watcher->outputSent += sent;
+		watcher->bytesSent += sent;
+	}
+
+	long long lag = MonotonicNanos() - watcher->waitingSince;
+
+	if (lag > watcher->maxLagNanos)
+	{
+		watcher->maxLagNanos = lag;
+	}
+
+	if (watcher->outputSent == watcher->outputLength)
+	{
+		watcher->outputSent = 0;
+		watcher->outputLength = 0;
+		watcher->midLine = false;
+	}
+}
+
+static bool Queue(struct Watcher *watcher, const char *text, int length)
+{
+	// Add a line to what's waiting to go to the spectator, first moving
+	// what's still to send to the front if it's in the way. If it still
+	// doesn't fit, drop the backlog, all but the end of a line already
+	// half sent, to send the whole game again instead, and return false.
+	if (watcher->outputLength + length > SPECTATE_BUFFER_LENGTH && watcher->outputSent > 0)
+	{
+		watcher->midLine = watcher->output[watcher->outputSent - 1] != '\n';
+		watcher->outputLength -= watcher->outputSent;
+		memmove(watcher->output, watcher->output + watcher->outputSent, watcher->outputLength);
+		watcher->outputSent = 0;
+	}
+
+	if (watcher->outputLength + length > SPECTATE_BUFFER_LENGTH)
+	{
+		if (watcher->midLine)
+		{
+			char *end = memchr(watcher->output, '\n', watcher->outputLength);
+
+			watcher->outputLength = end + 1 - watcher->output;
+		}
+		else
+		{
+			watcher->outputLength = 0;
+		}
+
+		watcher->drops++;
+		watcher->resync = true;
+		return false;
+	}
+
+	if (watcher->outputLength == watcher->outputSent)
+	{
+		watcher->waitingSince = MonotonicNanos();
+	}
+
+	memcpy(watcher->output + watcher->outputLength, text, length);
+	watcher->outputLength += length;
+
+	if (watcher->outputLength - watcher->outputSent > watcher->maxBacklog)
+	{
+		watcher->maxBacklog = watcher->outputLength - watcher->outputSent;
+	}
+
+	return true;
+}
+
+static int Header(char *at, char type, const struct Minefield *field, int cursorRow, int cursorCol, int seconds)
+{
+	char state = field->won ? 'W' : field->lost ? 'L' : 'P';
+
+	return sprintf(at, "%c %c %d %d %d %d", type, state, field->mines - field->flags, seconds, cursorRow, cursorCol);
+}
+
+void SpectatePublish(struct Minefield *field, int cursorRow, int cursorCol, int seconds)
+{
+	if (listener < 0)
+	{
+		field->changeCount = 0;
+		return;
+	}
+
+	AcceptWatchers();
+
+	char state = field->won ? 'W' : field->lost ? 'L' : 'P';
+	bool changed = field->changeCount > 0 || state != lastState || field->mines - field->flags != lastMinesLeft ||
+				   seconds != lastSeconds || cursorRow != lastRow || cursorCol != lastCol;
+
+	lastState = state;
+	lastMinesLeft = field->mines - field->flags;
+	lastSeconds = seconds;
+	lastRow = cursorRow;
+	lastCol = cursorCol;
+
+	// The changes, for everyone who's caught up.
+	char delta[64 + field->changeCount * 16];
+	int deltaLength = 0;
+
+	if (changed)
+	{
+		deltaLength = Header(delta, 'D', field, cursorRow, cursorCol, seconds);
+		deltaLength += sprintf(delta + deltaLength, " %d", field->changeCount);
+
+		for (int i = 0; i < field->changeCount; i++)
+		{
+			int index = field->changes[i];
+
+			deltaLength += sprintf(delta + deltaLength, " %d:%d:%c", index / field->cols, index % field->cols,
+								   MinefieldTileCharacter(&field->tiles[index]));
+		}
+
+		delta[deltaLength++] = '\n';
+	}
+
+	field->changeCount = 0;
+
+	// And the whole game, for anyone who's new or was dropped, made
+	// only if someone needs it.
+	char snapshot[64 + field->rows * (field->cols + 1)];
+	int snapshotLength = 0;
+
+	for (int i = 0; i < watcherCount; i++)
+	{
+		struct Watcher *watcher = watchers[i];
+
+		if (watcher->fd < 0)
+		{
+			continue;
+		}
+
+		if (!watcher->resync && changed && Queue(watcher, delta, deltaLength))
+		{
+			watcher->updates++;
+		}
+
+		// Dropping a spectator's backlog leaves no more than the rest of
+		// one line, so the whole game, which they're sent instead of the
+		// changes they missed, fits unless that line is a long one. Then
+		// Queue() keeps them waiting for it until the next publish.
+		if (watcher->resync)
+		{
+			if (snapshotLength == 0)
+			{
+				snapshotLength = Header(snapshot, 'B', field, cursorRow, cursorCol, seconds);
+				snapshotLength += sprintf(snapshot + snapshotLength, " %d %d ", field->rows, field->cols);
+
+				for (int row = 0; row < field->rows; row++)
+				{
+					for (int col = 0; col < field->cols; col++)
+					{
+						snapshot[snapshotLength++] = MinefieldTileCharacter(MinefieldTile(field, row, col));
+					}
+
+					snapshot[snapshotLength++] = row < field->rows - 1 ? '/' : '\n';
+				}
+			}
+
+			watcher->resync = false;
+			Queue(watcher, snapshot, snapshotLength);
+		}
+
+		Send(watcher);
+	}
+}
+
+void SpectateResync()
+{
+	for (int i = 0; i < watcherCount; i++)
+	{
+		watchers[i]->resync = true;
+	}
+}
+
+void SpectateClose(FILE *out)
+{
+	if (listener < 0)
+	{
+		return;
+	}
+
+	for (int i = 0; i < watcherCount; i++)
+	{
+		struct Watcher *watcher = watchers[i];
+
+		fprintf(out, "spectator %d: %lld updates, %lld bytes, dropped %lld times, backlog up to %lld bytes, lag up to %.1f ms\n",
+				i + 1, watcher->updates, watcher->bytesSent, watcher->drops, watcher->maxBacklog,
+				watcher->maxLagNanos / 1e6);
+
+		if (watcher->fd >= 0)
+		{
+			close(watcher->fd);
+		}
+
+		free(watcher);
+	}
+
+	close(listener);
+	unlink(listenPath);
+	free(listenPath);
+	listener = -1;
+	watcherCount = 0;
+}
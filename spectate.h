@@ -0,0 +1,48 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - spectators
+
+#ifndef SPECTATE_H
+#define SPECTATE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "minefield.h"
+
+// A game being played can be watched by any number of spectators over
+// a UNIX socket. Everything sent is a line of text. A spectator is sent
+// the whole game when they arrive:
+//
+//   B state minesLeft seconds row col rows cols tiles/tiles/...
+//
+// where row and col are the cursor and there's a character for each
+// tile, a row at a time. After that it's only sent what changed:
+//
+//   D state minesLeft seconds row col count row:col:tile ...
+//
+// with the same states and tile characters as the game server.
+//
+// The game never waits on a spectator. Each one has a buffer of its
+// own, sent from whenever the game publishes, and a spectator too far
+// behind to fit the next change has its backlog dropped and is sent
+// the whole game again instead. A game takes up to
+// SPECTATE_MAX_WATCHERS spectators over its life.
+
+#define SPECTATE_MAX_WATCHERS 64
+#define SPECTATE_BUFFER_LENGTH 16384
+
+// Start taking spectators on path. Returns false if it can't.
+bool SpectateOpen(const char *path);
+// Send the spectators what changed since the last call: the tiles the
+// field has tracked as changed (which it needs to be tracking, see
+// MinefieldTrackChanges()), the cursor and the clock. changeCount is
+// emptied. Nothing is sent if nothing changed.
+void SpectatePublish(struct Minefield *field, int cursorRow, int cursorCol, int seconds);
+// Send everyone the whole game at the next publish, after a new board.
+void SpectateResync();
+// Say how far behind each spectator fell, then stop taking them.
+void SpectateClose(FILE *out);
+
+#endif
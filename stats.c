@@ -0,0 +1,104 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - timing statistics
+
+#include <time.h>
+
+#include "stats.h"
+
+static int HistogramBucket(long long value)
+{
+	// Small values get a bucket each. Larger ones are grouped by their
+	// highest set bit, then by the next HISTOGRAM_SUB_BITS bits below it.
+	if (value < HISTOGRAM_SUB_BUCKETS)
+	{
+		return value < 0 ? 0 : (int) value;
+	}
+
+	int highBit = 63 - __builtin_clzll((unsigned long long) value);
+	int subBucket = (value >> (highBit - HISTOGRAM_SUB_BITS)) & (HISTOGRAM_SUB_BUCKETS - 1);
+
+	return (highBit - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + subBucket;
+}
+
+static long long HistogramBucketLimit(int bucket)
+{
+	// The largest value that lands in the given bucket.
+	if (bucket < HISTOGRAM_SUB_BUCKETS)
+	{
+		return bucket;
+	}
+
+	int highBit = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+	long long subBucket = bucket % HISTOGRAM_SUB_BUCKETS;
+	long long width = 1LL << (highBit - HISTOGRAM_SUB_BITS);
+
+	return (1LL << highBit) + (subBucket + 1) * width - 1;
+}
+
+void HistogramRecord(struct Histogram *histogram, long long value)
+{
+	histogram->counts[HistogramBucket(value)]++;
+	histogram->total++;
+	histogram->sum += value;
+
+	if (value > histogram->max)
+	{
+		histogram->max = value;
+	}
+}
+
+long long HistogramPercentile(struct Histogram *histogram, double percentile)
+{
+	// Walk the buckets until enough of the values have been seen,
+	// and report the top of that bucket.
+	long long wanted = (long long) (histogram->total * percentile / 100.0 + 0.5);
+	long long seen = 0;
+
+	if (wanted < 1)
+	{
+		wanted = 1;
+	}
+
+	for (int i = 0; i < HISTOGRAM_BUCKETS; i++)
+	{
+		seen += histogram->counts[i];
+
+		if (seen >= wanted)
+		{
+			long long limit = HistogramBucketLimit(i);
+			return limit < histogram->max ? limit : histogram->max;
+		}
+	}
+
+	return histogram->max;
+}
+
+void HistogramPrint(FILE *out, const char *label, struct Histogram *histogram, double scale, const char *units)
+{
+	// Values are divided by scale for printing, e.g. 1000 to show
+	// nanosecond samples in microseconds.
+	if (histogram->total == 0)
+	{
+		fprintf(out, "%s: no samples\n", label);
+		return;
+	}
+
+	fprintf(out, "%s: %lld samples, mean %.1f %s, p50 %.1f %s, p99 %.1f %s, max %.1f %s\n",
+			label, histogram->total,
+			histogram->sum / (double) histogram->total / scale, units,
+			HistogramPercentile(histogram, 50) / scale, units,
+			HistogramPercentile(histogram, 99) / scale, units,
+			histogram->max / scale, units);
+}
+
+long long MonotonicNanos()
+{
+	// Read the monotonic clock so that wall clock adjustments
+	// can't change the length of a game.
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
@@ -0,0 +1,32 @@
+// Parker Smith
+// CS3210
+// Term Project
+// Minesweeper - timing statistics
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+// Each power of two range of values is split into this many
+// linear sub buckets, which keeps percentiles within 12.5%.
+#define HISTOGRAM_SUB_BITS 3
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS (64 * HISTOGRAM_SUB_BUCKETS)
+
+// A fixed size log-linear histogram. Recording a value is a couple
+// of shifts and an increment, so it's cheap enough to leave on.
+struct Histogram {
+	long long counts[HISTOGRAM_BUCKETS];
+	long long total;
+	long long sum;
+	long long max;
+};
+
+long long MonotonicNanos();
+
+void HistogramRecord(struct Histogram *histogram, long long value);
+long long HistogramPercentile(struct Histogram *histogram, double percentile);
+void HistogramPrint(FILE *out, const char *label, struct Histogram *histogram, double scale, const char *units);
+
+#endif